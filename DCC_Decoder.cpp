@@ -16,42 +16,157 @@
 
 DCC_Decoder DCC;
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//
-// NMRA DCC Definitions
-//
-    // Microsecond 0 & 1 timings 
-#define    kONE_Min         52
-#define    kONE_Max         64
-
-#define    kZERO_Min        90
-#define    kZERO_Max        10000
-
-    // Minimum preamble length
-#define    kPREAMBLE_MIN    10
-
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // Interrupt handling
 //
+    // Edge timestamp source
+#if defined(DCC_TIMESTAMP_TIMER1)
+    #if defined(TCNT1)
+        #define DCC_TIMER_COUNT()   TCNT1
+    #else
+        #define DCC_TIMER_COUNT()   ((uint16_t)(micros() << 1))        // Host stand-in for a 2MHz 16 bit counter
+    #endif
+    #if defined(F_CPU) && F_CPU==8000000L
+        #define DCC_TIMER_SHIFT     0                                   // 1 tick per us
+    #else
+        #define DCC_TIMER_SHIFT     1                                   // 2 ticks per us
+    #endif
+    #define DCC_TIMER_WRAP_MICROS   (0x10000UL >> DCC_TIMER_SHIFT)      // Counter wraps this often
+#endif
+
 unsigned long          DCC_Decoder::gInterruptMicros = 0;
+uint16_t               DCC_Decoder::gInterruptTicks = 0;
+uint16_t               DCC_Decoder::gInterruptEdgeTicks = 0;
+unsigned long          DCC_Decoder::gInterruptTickMicros = 0;
+unsigned long          DCC_Decoder::gInterruptSyncMicros = 0;
+unsigned long          DCC_Decoder::gInterruptSyncTickMicros = 0;
+volatile unsigned long DCC_Decoder::gInterruptBitMicros = 0;
 byte                   DCC_Decoder::gInterruptTimeIndex = 0;
+byte                   DCC_Decoder::gInterruptPhase = 0;
+boolean                DCC_Decoder::gInterruptInjected = false;
 volatile unsigned int  DCC_Decoder::gInterruptTime[2];
 volatile unsigned int  DCC_Decoder::gInterruptChaos;
 
 ///////////////////////////////////////////////////
 
-void DCC_Decoder::DCC_Interrupt()
+inline void DCC_Decoder::RecordHalfPeriod(unsigned int period, unsigned long ms)
 {
-    unsigned long ms = micros();
-    gInterruptTime[gInterruptTimeIndex] = ms - gInterruptMicros;
+    gInterruptTime[gInterruptTimeIndex] = period;
     gInterruptMicros = ms;
+    if( gInterruptTimeIndex )
+    {
+        gInterruptBitMicros = ms;   // Edge that completed this bit
+    }
     gInterruptChaos += gInterruptTimeIndex;
     gInterruptTimeIndex ^= 0x01;    
 }
 
+void DCC_Decoder::DCC_Interrupt()
+{
+#if defined(DCC_TIMESTAMP_TIMER1)
+        // Whole microseconds since the last edge and since the clock anchor. Leftover ticks carry forward.
+    uint16_t ticks = DCC_TIMER_COUNT();
+    unsigned int period = (uint16_t)(ticks - gInterruptEdgeTicks) >> DCC_TIMER_SHIFT;
+    gInterruptEdgeTicks += period << DCC_TIMER_SHIFT;
+    unsigned int elapsed = (uint16_t)(ticks - gInterruptTicks) >> DCC_TIMER_SHIFT;
+    gInterruptTicks += elapsed << DCC_TIMER_SHIFT;
+    gInterruptTickMicros += elapsed;
+    RecordHalfPeriod(period, gInterruptTickMicros);
+#else
+    unsigned long ms = micros();
+    RecordHalfPeriod(ms - gInterruptMicros, ms);
+#endif
+}
+
+///////////////////////////////////////////////////
+
+unsigned long DCC_Decoder::EdgeMicros()
+{
+    if( gInterruptInjected )
+    {
+        return gInterruptMicros;    // InjectHalfPeriod's clock. Stands still between injected edges.
+    }
+#if defined(DCC_TIMESTAMP_TIMER1)
+    return EdgeClock_Sync();
+#else
+    return micros();
+#endif
+}
+
+///////////////////////////////////////////////////
+
+#if defined(DCC_TIMESTAMP_TIMER1)
+unsigned long DCC_Decoder::EdgeClock_Sync()
+{
+        // The 16 bit counter only measures gaps shorter than DCC_TIMER_WRAP_MICROS. Edges keep the anchor current
+        // while there's signal. Without signal (power up, lost track) loop() keeps it current, and if loop() 
+        // stalled long enough to hide wraps the anchor is carried forward on micros() instead.
+    noInterrupts();
+    uint16_t      ticks = DCC_TIMER_COUNT();
+    unsigned long real = micros();
+    if( real - gInterruptSyncMicros < DCC_TIMER_WRAP_MICROS/2 )
+    {
+        unsigned int elapsed = (uint16_t)(ticks - gInterruptTicks) >> DCC_TIMER_SHIFT;
+        gInterruptTicks += elapsed << DCC_TIMER_SHIFT;
+        gInterruptTickMicros += elapsed;
+    }else{
+        gInterruptTickMicros = gInterruptSyncTickMicros + (real - gInterruptSyncMicros);
+        gInterruptTicks = ticks;
+    }
+    gInterruptSyncMicros = real;
+    gInterruptSyncTickMicros = gInterruptTickMicros;
+    unsigned long ms = gInterruptTickMicros;
+    interrupts();
+    return ms;
+}
+#endif
+
+///////////////////////////////////////////////////
+
+void DCC_Decoder::InjectHalfPeriod(unsigned int periodMicros)
+{
+    noInterrupts();
+    gInterruptInjected = true;
+    RecordHalfPeriod(periodMicros, gInterruptMicros + periodMicros);
+    interrupts();
+}
+
+///////////////////////////////////////////////////
+
+unsigned long DCC_Decoder::InterruptCostMicros(unsigned int edges)
+{
+    unsigned long lastEdge = gInterruptMicros;
+    unsigned long bitEdge = gInterruptBitMicros;
+    unsigned int  time0 = gInterruptTime[0];
+    unsigned int  time1 = gInterruptTime[1];
+    unsigned int  chaos = gInterruptChaos;
+    byte          index = gInterruptTimeIndex;
+#if defined(DCC_TIMESTAMP_TIMER1)
+    uint16_t      edgeTicks = gInterruptEdgeTicks;
+#endif
+    
+    unsigned long start = micros();
+    for(unsigned int i=0; i<edges; ++i)
+    {
+        DCC_Interrupt();
+    }
+    unsigned long elapsed = micros() - start;
+    
+        // The anchor may stay where the edges moved it. Everything else goes back.
+    gInterruptMicros = lastEdge;
+    gInterruptBitMicros = bitEdge;
+    gInterruptTime[0] = time0;
+    gInterruptTime[1] = time1;
+    gInterruptChaos = chaos;
+    gInterruptTimeIndex = index;
+#if defined(DCC_TIMESTAMP_TIMER1)
+    gInterruptEdgeTicks = edgeTicks;
+#endif
+    return elapsed;
+}
+
 ///////////////////////////////////////////////////
 
 void DCC_Decoder::ShiftInterruptAlignment()
@@ -60,6 +175,7 @@ void DCC_Decoder::ShiftInterruptAlignment()
     gInterruptTime[0] = gInterruptTime[1];
     gInterruptTimeIndex = 1;
     interrupts();
+    gInterruptPhase ^= 0x01;
 }
 
 ///////////////////////////////////////////////////
@@ -70,8 +186,23 @@ void DCC_Decoder::StartInterrupt(byte interrupt)
     gInterruptTime[0] = gInterruptTime[1] = 0;
     gInterruptChaos = 0;
     gInterruptMicros = micros();
+    gBootMicros = gInterruptMicros;
+    
+#if defined(DCC_TIMESTAMP_TIMER1)
+    #if defined(TCNT1)
+        // Timer1 free running, normal mode, prescaler 8
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11);
+    #endif
+    gInterruptTicks = gInterruptEdgeTicks = DCC_TIMER_COUNT();
+    gInterruptTickMicros = gInterruptSyncMicros = gInterruptSyncTickMicros = gInterruptMicros;
+#endif
+    gFirstPacketMicros = 0;
     
-    attachInterrupt( interrupt, DCC_Interrupt, CHANGE );
+    if( interrupt != kDCC_NO_INTERRUPT )
+    {
+        attachInterrupt( interrupt, DCC_Interrupt, CHANGE );
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -86,6 +217,7 @@ StateFunc       DCC_Decoder::gState;                   // Current state function
 
     // Timing data from last interrupt
 unsigned int    DCC_Decoder::gLastChaos;                  // Interrupt chaos count we processed
+unsigned long   DCC_Decoder::gLastBitMicros;              // Microseconds of the edge that completed the last bit read
 
     // Preamble bit count
 int             DCC_Decoder::gPreambleCount;              // Bit count for reading preamble
@@ -103,9 +235,26 @@ boolean         DCC_Decoder::gPacketEndedWith1;           // Set true if packet
     // CV Storage
 byte            DCC_Decoder::gCV[kCV_MAX];                // CV Storage (TODO - Move to PROGMEM)
 
+    // RailCom cutout
+unsigned long   DCC_Decoder::gPacketEndMicros;            // Microseconds of last packet's end bit edge. Cutout starts 26-32us later
+unsigned long   DCC_Decoder::gCutoutStartMicros;          // Measured cutout start edge, else gPacketEndMicros
+boolean         DCC_Decoder::gCutoutWatch;                // Set after a packet end bit. Next bit may be a cutout
+boolean         DCC_Decoder::gCutoutDetected;             // Cutout seen after last packet
+
+    // Derived CV state
+int             DCC_Decoder::gDecoderAddress;             // Address() computed from CVs
+
+    // Boot timing
+unsigned long   DCC_Decoder::gBootMicros;                 // Microseconds at boot. Interrupt start, or SetupDecoderFromSnapshot entry
+unsigned long   DCC_Decoder::gFirstPacketMicros;          // End bit microseconds of first valid packet. 0 until then
+
     // Packet arrival timing
 unsigned long   DCC_Decoder::gThisPacketMS;               // Milliseconds of this packet being parsed
 boolean         DCC_Decoder::gLastPacketToThisAddress;    // Was last pack processed to this decoder's address?
+int             DCC_Decoder::gThisPacketAddress;          // Accessory address decoded from this packet
+
+DCCAddressStats* DCC_Decoder::gAddressStats = NULL;       // Refresh statistics table supplied by sketch
+byte            DCC_Decoder::gAddressStatsCount = 0;
 
 unsigned long   DCC_Decoder::gLastValidPacketMS;          // Milliseconds of last valid packet
 unsigned long   DCC_Decoder::gLastValidPacketToAddressMS; // Milliseconds of last valid packet to this decoder
@@ -137,6 +286,129 @@ unsigned long DCC_Decoder::MillisecondsSinceLastResetPacket()
     return millis() - gLastValidResetPacketMS;
 }
 
+unsigned long DCC_Decoder::MicrosecondsFromBootToFirstPacket()
+{
+    return gFirstPacketMicros ? gFirstPacketMicros - gBootMicros : 0;
+}
+
+unsigned long DCC_Decoder::CutoutStartMicros()
+{
+    return gCutoutStartMicros;
+}
+
+boolean DCC_Decoder::CutoutDetected()
+{
+    return gCutoutDetected;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Per address refresh statistics. Intervals are measured between packet end bit edges.
+//
+void DCC_Decoder::SetAddressStatisticsTable(DCCAddressStats* table, byte count)
+{
+    for(byte i=0; i<count; ++i)
+    {
+        table[i].kind = 0;
+    }
+    gAddressStatsCount = count;
+    gAddressStats = (count ? table : NULL);
+}
+
+unsigned long DCC_Decoder::MeanRefreshMicros(DCCAddressStats* stats)
+{
+    return stats->intervals ? stats->totalMicros / stats->intervals : 0;
+}
+
+void DCC_Decoder::UpdateAddressStatistics()
+{
+    int  address;
+    byte kind;
+    
+        // Figure out who this packet was addressed to
+    if( gPacket[0]>=0x01 && gPacket[0]<=0x7F )
+    {
+        kind = kDCC_ADDR_SHORT;
+        address = gPacket[0];
+    }else if( gPacket[0]>=0xC0 && gPacket[0]<=0xE7 ){
+        kind = kDCC_ADDR_LONG;
+        address = ((gPacket[0] & 0x3F)<<8) | gPacket[1];
+    }else if( gResetReason==kDCC_OK_BASIC_ACCESSORY ){
+        kind = kDCC_ADDR_BASIC_ACC;
+        address = gThisPacketAddress;
+    }else if( gResetReason==kDCC_OK_EXTENDED_ACCESSORY ){
+        kind = kDCC_ADDR_EXTD_ACC;
+        address = gThisPacketAddress;
+    }else{
+        return;     // Broadcast, idle or unsupported
+    }
+    
+        // Find entry. Remember an empty or least recently seen one to replace.
+    DCCAddressStats* stats = NULL;
+    DCCAddressStats* replace = &gAddressStats[0];
+    for(byte i=0; i<gAddressStatsCount; ++i)
+    {
+        DCCAddressStats* entry = &gAddressStats[i];
+        if( entry->kind==kind && entry->address==address )
+        {
+            stats = entry;
+            break;
+        }
+        if( replace->kind && (!entry->kind || (gPacketEndMicros-entry->lastMicros) > (gPacketEndMicros-replace->lastMicros)) )
+        {
+            replace = entry;
+        }
+    }
+    
+    if( !stats )
+    {
+        stats = replace;
+        stats->address = address;
+        stats->kind = kind;
+        stats->packets = 1;
+        stats->intervals = 0;
+        stats->lastMicros = gPacketEndMicros;
+        stats->lastIntervalMicros = 0;
+        stats->minMicros = 0xFFFFFFFF;
+        stats->maxMicros = 0;
+        stats->totalMicros = 0;
+        stats->jitterMicros = 0;
+        return;
+    }
+    
+    unsigned long interval = gPacketEndMicros - stats->lastMicros;
+    stats->lastMicros = gPacketEndMicros;
+    if( stats->packets < 0xFFFF )
+    {
+        ++stats->packets;
+    }
+    
+    if( interval < stats->minMicros ) stats->minMicros = interval;
+    if( interval > stats->maxMicros ) stats->maxMicros = interval;
+    
+        // Halve the sum when it gets large. Mean is unchanged.
+    if( stats->intervals==0xFFFF || stats->totalMicros>=0x80000000 )
+    {
+        stats->totalMicros >>= 1;
+        stats->intervals >>= 1;
+    }
+    stats->totalMicros += interval;
+    ++stats->intervals;
+    
+    if( stats->intervals > 1 )
+    {
+        unsigned long delta = (interval > stats->lastIntervalMicros) ? interval - stats->lastIntervalMicros : stats->lastIntervalMicros - interval;
+        if( delta > stats->jitterMicros )
+        {
+            stats->jitterMicros += (delta - stats->jitterMicros) >> 4;
+        }else{
+            stats->jitterMicros -= (stats->jitterMicros - delta) >> 4;
+        }
+    }
+    stats->lastIntervalMicros = interval;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -156,28 +428,99 @@ void DCC_Decoder::WriteCV(int cv, byte data)
     if( cv>=kCV_PrimaryAddress && cv<kCV_MAX && cv!=kCV_ManufacturerVersionNo && cv!=kCV_ManufacturerVersionNo )
     {
         gCV[cv] = data;
+        
+            // Rebuild derived state if an address or speed CV changed
+        if( cv==kCV_PrimaryAddress || cv==kCV_AddressMSB || cv==kCV_ExtendedAddress1 || cv==kCV_ExtendedAddress2 || cv==kCV_ConfigurationData1 )
+        {
+            Address_Build();
+        }
+        if( (cv>=kCV_Vstart && cv<=kCV_Vmid) || cv==kCV_ConfigurationData1 || (cv>=kCV_SpeedTableFirst && cv<=kCV_SpeedTableLast) )
+        {
+            SpeedEngine_Build();
+        }
     }
 }
 
 int DCC_Decoder::Address()
 {
-    int address;
+    return gDecoderAddress;
+}
 
-    byte cv29 = DCC_Decoder::ReadCV(kCV_ConfigurationData1);
+void DCC_Decoder::Address_Build()
+{
+    byte cv29 = gCV[kCV_ConfigurationData1];
 
     if( cv29 & 0x80 )   // Is this an accessory decoder?
     {
-        address = DCC_Decoder::ReadCV(kCV_AddressMSB)<<6 | DCC_Decoder::ReadCV(kCV_AddressMSB);        
+        gDecoderAddress = (gCV[kCV_AddressMSB] & 0x07)<<6 | (gCV[kCV_AddressLSB] & 0x3F);
     }else{
         if( cv29 & 0x20 )   // Multifunction using extended addresses?
         {
-            address = DCC_Decoder::ReadCV(kCV_ExtendedAddress1)<<8 | DCC_Decoder::ReadCV(kCV_ExtendedAddress2);        
+            gDecoderAddress = (gCV[kCV_ExtendedAddress1] & 0x3F)<<8 | gCV[kCV_ExtendedAddress2];
         }else{
-            address = DCC_Decoder::ReadCV(kCV_PrimaryAddress);
+            gDecoderAddress = gCV[kCV_PrimaryAddress];
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// CV snapshot. Header (magic, CV count, Fletcher-16 checksum) followed by the whole CV block, so a sketch can restore 
+// every CV with one block read from EEPROM. The header is written last so a torn save fails the checksum.
+//
+unsigned int DCC_Decoder::CVSnapshot_Checksum()
+{
+        // Wide sums can't overflow over kCV_MAX bytes, so reduce mod 255 once at the end instead of per byte
+    unsigned long sum1 = 0;
+    unsigned long sum2 = 0;
+    
+    for(int i=0; i<kCV_MAX; ++i)
+    {
+        sum1 += gCV[i];
+        sum2 += sum1;
+    }
+    return ((sum2 % 255)<<8) | (sum1 % 255);
+}
+
+boolean DCC_Decoder::SetupDecoderFromSnapshot(byte mfgID, byte mfgVers, byte interrupt, CVSnapshotIO readFunc)
+{
+    boolean valid = false;
+    unsigned long bootMicros = micros();    // Boot starts here so the snapshot read counts toward the first packet time
+    
+    if( gInterruptMicros == 0 )
+    {
+        byte header[kCV_SNAPSHOT_HEADER];
+        (readFunc)(0, header, kCV_SNAPSHOT_HEADER);
+        
+        if( header[0]==kCV_SNAPSHOT_MAGIC && header[1]==(kCV_MAX>>8) && header[2]==(kCV_MAX & 0xFF) )
+        {
+            (readFunc)(kCV_SNAPSHOT_HEADER, gCV, kCV_MAX);
+            
+            unsigned int sum = CVSnapshot_Checksum();
+            valid = (header[3]==(sum>>8) && header[4]==(sum & 0xFF));
         }
+        if( !valid )
+        {
+            memset(gCV, 0, sizeof(gCV));
+        }
+        
+            // Derived state is built here before the interrupt starts
+        SetupDecoder(mfgID, mfgVers, interrupt);
+        gBootMicros = bootMicros;
     }
+    
+    return valid;
+}
 
-    return address;
+void DCC_Decoder::SaveCVSnapshot(CVSnapshotIO writeFunc)
+{
+    unsigned int sum = CVSnapshot_Checksum();
+    byte header[kCV_SNAPSHOT_HEADER] = { kCV_SNAPSHOT_MAGIC, (byte)(kCV_MAX>>8), (byte)(kCV_MAX & 0xFF), 
+                                         (byte)(sum>>8), (byte)(sum & 0xFF) };
+    
+    (writeFunc)(kCV_SNAPSHOT_HEADER, gCV, kCV_MAX);
+    (writeFunc)(0, header, kCV_SNAPSHOT_HEADER);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -216,40 +559,444 @@ void DCC_Decoder::SetBasicAccessoryDecoderPacketHandler(BasicAccDecoderPacket fu
 
 //////////////////////////////////////////////////////////////
 
-ExtendedAccDecoderPacket DCC_Decoder::func_ExtdAccPacket = NULL;
-boolean                  DCC_Decoder::func_ExtdAccPacket_All_Packets = false;
-
-void DCC_Decoder::SetExtendedAccessoryDecoderPacketHandler(ExtendedAccDecoderPacket func, boolean allPackets)
+ExtendedAccDecoderPacket DCC_Decoder::func_ExtdAccPacket = NULL;
+boolean                  DCC_Decoder::func_ExtdAccPacket_All_Packets = false;
+
+void DCC_Decoder::SetExtendedAccessoryDecoderPacketHandler(ExtendedAccDecoderPacket func, boolean allPackets)
+{
+    func_ExtdAccPacket = func;
+    func_ExtdAccPacket_All_Packets = allPackets;
+}
+
+//////////////////////////////////////////////////////////////
+
+DCCPacketFilterRule* DCC_Decoder::gFilterRules = NULL;
+byte                 DCC_Decoder::gFilterStart[kPACKET_LEN_MAX+2];
+byte                 DCC_Decoder::gFilterDefault = kDCC_FILTER_ACCEPT;
+
+void DCC_Decoder::SetPacketFilter(DCCPacketFilterRule* rules, byte count, byte defaultAction)
+{
+    gFilterRules = NULL;
+    if( !rules || !count )
+    {
+        return;
+    }
+    
+        // Stable sort by length so first match order is kept within each length
+    for(byte i=1; i<count; ++i)
+    {
+        DCCPacketFilterRule rule = rules[i];
+        byte j = i;
+        while( j>0 && rules[j-1].length > rule.length )
+        {
+            rules[j] = rules[j-1];
+            --j;
+        }
+        rules[j] = rule;
+    }
+    
+        // Rules for length n are gFilterStart[n] up to gFilterStart[n+1]
+    byte r = 0;
+    for(byte len=0; len<=kPACKET_LEN_MAX+1; ++len)
+    {
+        while( r<count && rules[r].length<len )
+        {
+            ++r;
+        }
+        gFilterStart[len] = r;
+    }
+    
+    gFilterDefault = defaultAction;
+    gFilterRules = rules;
+}
+
+byte DCC_Decoder::MakeLongAddressFilterRules(DCCPacketFilterRule* rules, byte maxRules, int first, int last, 
+                                             byte instructionMask, byte instructionValue, byte length, byte action)
+{
+    byte count = 0;
+    long address = first;
+    
+    while( address<=last && count<maxRules )
+    {
+            // Largest aligned power of 2 block starting at address that fits in range
+        long size = 1;
+        while( !(address & size) && (address + size*2 - 1)<=last && size<0x2000 )
+        {
+            size <<= 1;
+        }
+        
+        unsigned int mask = ~(size-1) & 0x3FFF;
+        rules[count].length = length;
+        rules[count].mask[0] = 0xC0 | (mask>>8);
+        rules[count].value[0] = 0xC0 | (address>>8);
+        rules[count].mask[1] = mask & 0xFF;
+        rules[count].value[1] = address & 0xFF;
+        rules[count].mask[2] = instructionMask;
+        rules[count].value[2] = instructionValue & instructionMask;
+        rules[count].action = action;
+        ++count;
+        
+        address += size;
+    }
+    return count;
+}
+
+boolean DCC_Decoder::PacketFilter_Accept()
+{
+    for(byte i=gFilterStart[gPacketIndex]; i<gFilterStart[gPacketIndex+1]; ++i)
+    {
+        DCCPacketFilterRule* rule = &gFilterRules[i];
+        if( (gPacket[0] & rule->mask[0])==rule->value[0] && 
+            (gPacket[1] & rule->mask[1])==rule->value[1] && 
+            (gPacket[2] & rule->mask[2])==rule->value[2] )
+        {
+            return rule->action==kDCC_FILTER_ACCEPT;
+        }
+    }
+    return gFilterDefault==kDCC_FILTER_ACCEPT;
+}
+
+//////////////////////////////////////////////////////////////
+
+IdleResetPacket DCC_Decoder::func_IdlePacket = NULL;
+
+void DCC_Decoder::SetIdlePacketHandler(IdleResetPacket func)
+{
+    func_IdlePacket = func;
+}
+
+//////////////////////////////////////////////////////////////
+
+IdleResetPacket DCC_Decoder::func_ResetPacket = NULL;
+
+void DCC_Decoder::SetResetPacketHandler(IdleResetPacket func)
+{
+    func_ResetPacket = func;
+}
+
+//////////////////////////////////////////////////////////////
+
+RailComCutout DCC_Decoder::func_RailComCutout = NULL;
+
+void DCC_Decoder::SetRailComCutoutHandler(RailComCutout func)
+{
+    func_RailComCutout = func;
+}
+
+//////////////////////////////////////////////////////////////
+
+DecodingEngineCompletion DCC_Decoder::func_DecodingEngineCompletion = NULL;
+
+void DCC_Decoder::SetDecodingEngineCompletionStatusHandler(DecodingEngineCompletion func)
+{
+    func_DecodingEngineCompletion = func;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Speed engine. The speed table and momentum steps are precomputed from CVs whenever WriteCV changes them, so a speed packet 
+// is a table lookup and each momentum tick is one add.
+//
+SpeedOutput     DCC_Decoder::func_SpeedOutput = NULL;
+unsigned int    DCC_Decoder::gSpeedTable[kSPEED_STEPS+1];
+unsigned long   DCC_Decoder::gSpeedAccelStep = 0;
+unsigned long   DCC_Decoder::gSpeedDecelStep = 0;
+unsigned long   DCC_Decoder::gSpeedCurrent = 0;
+unsigned long   DCC_Decoder::gSpeedTarget = 0;
+boolean         DCC_Decoder::gSpeedForward = true;
+boolean         DCC_Decoder::gSpeedForwardTarget = true;
+byte            DCC_Decoder::gSpeedLevel = 0;
+unsigned long   DCC_Decoder::gSpeedTickMS = 0;
+
+void DCC_Decoder::SetSpeedOutputHandler(SpeedOutput func)
+{
+    SpeedEngine_Build();
+    gSpeedTickMS = millis();
+    func_SpeedOutput = func;
+}
+
+//////////////////////////////////////////////////////////////
+
+void DCC_Decoder::SpeedEngine_Build()
+{
+    gSpeedTable[0] = 0;
+    
+    if( gCV[kCV_ConfigurationData1] & 0x10 )
+    {
+            // CV29 bit 4. Use loadable speed table CV67-94
+        for(byte i=1; i<=kSPEED_STEPS; ++i)
+        {
+            gSpeedTable[i] = gCV[kCV_SpeedTableFirst+i-1] << 8;
+        }
+    }else{
+            // Three point curve. Vhigh of 0 or 1 means full scale. Vmid of 0 means halfway.
+        long vStart = gCV[kCV_Vstart];
+        long vHigh  = (gCV[kCV_Vhigh] > 1) ? gCV[kCV_Vhigh] : 255;
+        long vMid   = gCV[kCV_Vmid] ? gCV[kCV_Vmid] : (vStart+vHigh)/2;
+        
+        for(byte i=1; i<=kSPEED_STEPS/2; ++i)
+        {
+            gSpeedTable[i] = (vStart<<8) + ((vMid-vStart)<<8) * (i-1) / (kSPEED_STEPS/2-1);
+        }
+        for(byte i=kSPEED_STEPS/2+1; i<=kSPEED_STEPS; ++i)
+        {
+            gSpeedTable[i] = (vMid<<8) + ((vHigh-vMid)<<8) * (i-kSPEED_STEPS/2) / (kSPEED_STEPS/2);
+        }
+    }
+    
+        // S 9.2.2: full range takes CV * 0.896 seconds. 0 means no momentum.
+    gSpeedAccelStep = gCV[kCV_AccelerationRate] ? (255UL<<16) * kSPEED_TICK_MS / (gCV[kCV_AccelerationRate] * 896UL) : 0;
+    gSpeedDecelStep = gCV[kCV_DecelerationRate] ? (255UL<<16) * kSPEED_TICK_MS / (gCV[kCV_DecelerationRate] * 896UL) : 0;
+}
+
+//////////////////////////////////////////////////////////////
+
+void DCC_Decoder::SpeedEngine_Packet(byte speed, boolean forward)
+{
+    gSpeedForwardTarget = forward;
+    
+    if( speed == kDCC_ESTOP_SPEED )
+    {
+            // Emergency stop skips momentum
+        gSpeedTarget = gSpeedCurrent = 0;
+    }else if( speed == kDCC_STOP_SPEED ){
+        gSpeedTarget = 0;
+    }else{
+            // 14 step mode uses every other table entry
+        if( !(gCV[kCV_ConfigurationData1] & 0x02) )
+        {
+            speed <<= 1;
+        }
+        if( speed > kSPEED_STEPS )
+        {
+            speed = kSPEED_STEPS;
+        }
+        gSpeedTarget = (unsigned long)gSpeedTable[speed] << 8;
+    }
+    
+        // Momentum steps are left to the tick so the rate doesn't depend on packet refresh
+    SpeedEngine_Step(false);
+}
+
+//////////////////////////////////////////////////////////////
+
+void DCC_Decoder::SpeedEngine_Step(boolean tick)
+{
+    boolean forward = gSpeedForward;
+    
+        // Second pass only after stopping to reverse. Without momentum that reaches the new speed in one call.
+    for(byte pass=0; pass<2; ++pass)
+    {
+            // Reversing? Slow to a stop first.
+        unsigned long target = (gSpeedForward == gSpeedForwardTarget) ? gSpeedTarget : 0;
+        
+        if( gSpeedCurrent < target )
+        {
+            if( !gSpeedAccelStep || (tick && !pass && target-gSpeedCurrent <= gSpeedAccelStep) )
+            {
+                gSpeedCurrent = target;
+            }else if( tick && !pass ){
+                gSpeedCurrent += gSpeedAccelStep;
+            }
+        }else if( gSpeedCurrent > target ){
+            if( !gSpeedDecelStep || (tick && !pass && gSpeedCurrent-target <= gSpeedDecelStep) )
+            {
+                gSpeedCurrent = target;
+            }else if( tick && !pass ){
+                gSpeedCurrent -= gSpeedDecelStep;
+            }
+        }
+        
+        if( gSpeedCurrent!=0 || gSpeedForward==gSpeedForwardTarget )
+        {
+            break;
+        }
+        gSpeedForward = gSpeedForwardTarget;
+    }
+    
+    boolean changed = (forward != gSpeedForward);
+    if( gSpeedLevel != (byte)(gSpeedCurrent>>16) )
+    {
+        gSpeedLevel = gSpeedCurrent>>16;
+        changed = true;
+    }
+    if( changed && func_SpeedOutput )
+    {
+        (func_SpeedOutput)(gSpeedLevel, gSpeedForward);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Accessory output scheduler. Pending pulse/flash timers live in a hashed timer wheel. Each slot holds a doubly linked list
+// of output indexes so insert and cancel are constant time. loop() advances at most kACC_WHEEL_SLICE slots per call.
+//
+AccessoryOutputAction DCC_Decoder::func_AccOutputAction = NULL;
+DCCAccessoryOutput*   DCC_Decoder::gAccOutputs = NULL;
+byte                  DCC_Decoder::gAccOutputCount = 0;
+byte                  DCC_Decoder::gAccWheel[kACC_WHEEL_SLOTS];
+byte                  DCC_Decoder::gAccWheelSlot = 0;
+unsigned long         DCC_Decoder::gAccWheelMS = 0;
+
+void DCC_Decoder::SetAccessoryOutputs(DCCAccessoryOutput* outputs, byte count, AccessoryOutputAction func)
+{
+    gAccOutputs = NULL;
+    
+    for(byte i=0; i<kACC_WHEEL_SLOTS; ++i)
+    {
+        gAccWheel[i] = kACC_WHEEL_NONE;
+    }
+    for(byte i=0; i<count; ++i)
+    {
+        outputs[i].active = false;
+        outputs[i].on = false;
+        outputs[i].wheelSlot = kACC_WHEEL_NONE;
+        outputs[i].wheelNext = kACC_WHEEL_NONE;
+        outputs[i].wheelPrev = kACC_WHEEL_NONE;
+        outputs[i].wheelRounds = 0;
+    }
+    
+    gAccWheelSlot = 0;
+    gAccWheelMS = millis();
+    gAccOutputCount = (count < kACC_WHEEL_NONE) ? count : kACC_WHEEL_NONE-1;
+    func_AccOutputAction = func;
+    gAccOutputs = outputs;
+}
+
+//////////////////////////////////////////////////////////////
+
+void DCC_Decoder::AccOutput_Set(byte index, boolean on)
+{
+    if( gAccOutputs[index].on != on )
+    {
+        gAccOutputs[index].on = on;
+        if( func_AccOutputAction )
+        {
+            (func_AccOutputAction)(index, on);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////
+
+void DCC_Decoder::AccOutput_Schedule(byte index, unsigned int ms)
+{
+    DCCAccessoryOutput* output = &gAccOutputs[index];
+    
+        // Round up to whole ticks. Always at least one tick out.
+    unsigned int ticks = (ms + kACC_WHEEL_TICK_MS - 1) / kACC_WHEEL_TICK_MS;
+    if( ticks == 0 )
+    {
+        ticks = 1;
+    }
+    
+    byte slot = (gAccWheelSlot + ticks) & (kACC_WHEEL_SLOTS-1);
+    output->wheelSlot = slot;
+    output->wheelRounds = (ticks-1) >> kACC_WHEEL_SHIFT;
+    output->wheelPrev = kACC_WHEEL_NONE;
+    output->wheelNext = gAccWheel[slot];
+    if( gAccWheel[slot] != kACC_WHEEL_NONE )
+    {
+        gAccOutputs[gAccWheel[slot]].wheelPrev = index;
+    }
+    gAccWheel[slot] = index;
+}
+
+//////////////////////////////////////////////////////////////
+
+void DCC_Decoder::AccOutput_Cancel(byte index)
 {
-    func_ExtdAccPacket = func;
-    func_ExtdAccPacket_All_Packets = allPackets;
+    DCCAccessoryOutput* output = &gAccOutputs[index];
+    
+    if( output->wheelSlot == kACC_WHEEL_NONE )
+    {
+        return;
+    }
+    
+    if( output->wheelPrev != kACC_WHEEL_NONE )
+    {
+        gAccOutputs[output->wheelPrev].wheelNext = output->wheelNext;
+    }else{
+        gAccWheel[output->wheelSlot] = output->wheelNext;
+    }
+    if( output->wheelNext != kACC_WHEEL_NONE )
+    {
+        gAccOutputs[output->wheelNext].wheelPrev = output->wheelPrev;
+    }
+    output->wheelSlot = output->wheelNext = output->wheelPrev = kACC_WHEEL_NONE;
 }
 
 //////////////////////////////////////////////////////////////
 
-IdleResetPacket DCC_Decoder::func_IdlePacket = NULL;
-
-void DCC_Decoder::SetIdlePacketHandler(IdleResetPacket func)
+void DCC_Decoder::AccOutput_Expire(byte index)
 {
-    func_IdlePacket = func;
+    DCCAccessoryOutput* output = &gAccOutputs[index];
+    
+    if( output->mode==kACC_OUTPUT_FLASH && output->active )
+    {
+            // Flasher still activated. Toggle and go around again.
+        AccOutput_Set(index, !output->on);
+        AccOutput_Schedule(index, output->durationMS);
+    }else{
+            // Pulse complete
+        output->active = false;
+        AccOutput_Set(index, false);
+    }
 }
 
 //////////////////////////////////////////////////////////////
 
-IdleResetPacket DCC_Decoder::func_ResetPacket = NULL;
-
-void DCC_Decoder::SetResetPacketHandler(IdleResetPacket func)
+void DCC_Decoder::AccOutput_Packet(int address, boolean isExtended, boolean enable)
 {
-    func_ResetPacket = func;
+    for(byte i=0; i<gAccOutputCount; ++i)
+    {
+        DCCAccessoryOutput* output = &gAccOutputs[i];
+        
+        if( output->address!=address || output->isExtended!=isExtended )
+        {
+            continue;
+        }
+        
+        AccOutput_Cancel(i);
+        output->active = enable;
+        AccOutput_Set(i, enable);
+        
+        if( enable && output->mode!=kACC_OUTPUT_LATCH && output->durationMS )
+        {
+            AccOutput_Schedule(i, output->durationMS);
+        }
+    }
 }
 
 //////////////////////////////////////////////////////////////
 
-DecodingEngineCompletion DCC_Decoder::func_DecodingEngineCompletion = NULL;
-
-void DCC_Decoder::SetDecodingEngineCompletionStatusHandler(DecodingEngineCompletion func)
+void DCC_Decoder::AccOutput_Loop()
 {
-    func_DecodingEngineCompletion = func;
+    unsigned long now = millis();
+    byte slice = kACC_WHEEL_SLICE;
+    
+    while( slice-- && (now - gAccWheelMS) >= kACC_WHEEL_TICK_MS )
+    {
+        gAccWheelMS += kACC_WHEEL_TICK_MS;
+        gAccWheelSlot = (gAccWheelSlot + 1) & (kACC_WHEEL_SLOTS-1);
+        
+            // Walk slot. Expire timers on their last round, count down the others.
+        byte index = gAccWheel[gAccWheelSlot];
+        while( index != kACC_WHEEL_NONE )
+        {
+            byte next = gAccOutputs[index].wheelNext;
+            if( gAccOutputs[index].wheelRounds )
+            {
+                --gAccOutputs[index].wheelRounds;
+            }else{
+                AccOutput_Cancel(index);
+                AccOutput_Expire(index);
+            }
+            index = next;
+        }
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -282,10 +1029,23 @@ void DCC_Decoder::State_Execute()
         GOTO_DecoderReset( kDCC_ERR_DETECTION_FAILED );
     }
     
-        // Save off milliseconds of this valid packet
-    gThisPacketMS = millis();
+        // Packet is good. Let RailCom hardware know before anything else runs.
+    if( func_RailComCutout )
+    {
+        (func_RailComCutout)(gPacketIndex, gPacket, gPacketEndMicros);
+    }
+    
+        // Save off milliseconds of this valid packet. Back dated to the end bit edge.
+    gThisPacketMS = millis() - (DCC.EdgeMicros() - gPacketEndMicros)/1000;
     gLastPacketToThisAddress = false;
     
+        ///////////////////////////////////////////////////////////
+        // Packet filter. Rejected packets go no further.
+    if( gFilterRules && !PacketFilter_Accept() )
+    {
+        GOTO_DecoderReset( kDCC_OK_FILTERED );
+    }
+    
         ///////////////////////////////////////////////////////////
         // Dispatch to RawPacketHandler - All packets go to raw (except idle and reset above)
         // 
@@ -333,6 +1093,7 @@ void DCC_Decoder::State_Execute()
         {
             address = ~gPacket[1] & 0x70;
             address = (address<<2) + (gPacket[0] & 0x3F);
+            gThisPacketAddress = address;
             gLastPacketToThisAddress = (address==DCC.Address());
             if( gLastPacketToThisAddress || address == 0x003F || func_BasicAccPacket_All_Packets )    // 0x003F is broadcast packet
             {
@@ -342,6 +1103,12 @@ void DCC_Decoder::State_Execute()
                     (func_BasicAccPacket)( address, ((gPacket[1] & 0x08) ? true : false), (gPacket[1] & 0x07));
                 }
             }
+            if( !gHandledAsRawPacket && gAccOutputs && (gPacket[1] & 0x08) )
+            {
+                    // Convert NMRA packet address format to human output address. Bit 0 selects on/off. Only 
+                    // activate packets (C=1) switch outputs. The deactivate that follows would restart a pulse.
+                AccOutput_Packet( ((address-1)<<2) + 1 + ((gPacket[1] & 0x06)>>1), false, (gPacket[1] & 0x01) ? true : false );
+            }
             GOTO_DecoderReset( kDCC_OK_BASIC_ACCESSORY );
         }
             
@@ -377,7 +1144,7 @@ void DCC_Decoder::State_Execute()
             }else{            
                 if( gCV[kCV_ConfigurationData1] & 0x02 )  // Bit 1 of CV29: 0=14speeds, 1=28Speeds
                 {
-                    speedBits = ((speedBits << 1 ) & (cBit ? 1 : 0)) - 3;   // speedBits = 1..28
+                    speedBits = ((speedBits << 1 ) | (cBit ? 1 : 0)) - 3;   // speedBits = 1..28
                 }else{
                     speedBits -= 1;                                         // speedBits = 1..14
                 }
@@ -392,6 +1159,10 @@ void DCC_Decoder::State_Execute()
             {
                 (*func_BaselineControlPacket)(addressByte,speedBits,directionBit);
             }
+            if( gLastPacketToThisAddress && !gHandledAsRawPacket && func_SpeedOutput )
+            {
+                SpeedEngine_Packet(speedBits, directionBit ? true : false);
+            }
         }
         GOTO_DecoderReset( kDCC_OK_BASELINE );      
     }
@@ -408,6 +1179,7 @@ void DCC_Decoder::State_Execute()
             int msb = (gPacket[1] & 0x06);            
             address = (gPacket[1] & 0x70);
             address = (msb<<8) + (address<<2) + (gPacket[0] & 0x3F);
+            gThisPacketAddress = address;
             gLastPacketToThisAddress = (address==DCC.Address());
             if( gLastPacketToThisAddress || address == 0x033F || func_ExtdAccPacket_All_Packets )    // 0x033F is broadcast packet
             {
@@ -417,6 +1189,11 @@ void DCC_Decoder::State_Execute()
                     (*func_ExtdAccPacket)( address, gPacket[2] & 0x1F);
                 }
             }
+            if( !gHandledAsRawPacket && gAccOutputs )
+            {
+                    // Aspect 0 is off. All others on.
+                AccOutput_Packet( address, true, (gPacket[2] & 0x1F) ? true : false );
+            }
             GOTO_DecoderReset( kDCC_OK_EXTENDED_ACCESSORY );
         }
     }
@@ -442,6 +1219,83 @@ void DCC_Decoder::State_Execute()
     GOTO_DecoderReset( kDCC_OK );
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Signal quality analyzer. Runs from the interrupt reader on raw half periods, before they're judged one or zero.
+//
+DCCSignalStats* DCC_Decoder::gSignalStats = NULL;
+
+void DCC_Decoder::SetSignalAnalyzer(DCCSignalStats* stats)
+{
+    if( stats )
+    {
+        memset(stats, 0, sizeof(DCCSignalStats));
+    }
+    gSignalStats = stats;
+}
+
+void DCC_Decoder::SignalAnalyzer_Add(unsigned int* histogram, int bin)
+{
+    if( bin < 0 )             bin = 0;
+    if( bin >= kSIGNAL_BINS ) bin = kSIGNAL_BINS-1;
+    
+        // Full bin? Halve the whole histogram to keep its shape.
+    if( histogram[bin] == 0xFFFF )
+    {
+        for(byte i=0; i<kSIGNAL_BINS; ++i)
+        {
+            histogram[i] >>= 1;
+        }
+    }
+    ++histogram[bin];
+}
+
+void DCC_Decoder::SignalAnalyzer_Half(unsigned int period)
+{
+    ++gSignalStats->halfPeriods;
+    
+    if( period < kONE_Min || (period > kONE_Max && period < kZERO_Min) || period > kZERO_Max )
+    {
+        if( gSignalStats->outOfRange < 0xFFFF ) ++gSignalStats->outOfRange;
+    }
+    
+    if( period <= kONE_Min+kSIGNAL_NEAR && period+kSIGNAL_NEAR >= kONE_Min )
+    {
+        if( gSignalStats->nearOneMin < 0xFFFF ) ++gSignalStats->nearOneMin;
+    }else if( period <= kONE_Max+kSIGNAL_NEAR && period+kSIGNAL_NEAR >= kONE_Max ){
+        if( gSignalStats->nearOneMax < 0xFFFF ) ++gSignalStats->nearOneMax;
+    }else if( period <= kZERO_Min+kSIGNAL_NEAR && period+kSIGNAL_NEAR >= kZERO_Min ){
+        if( gSignalStats->nearZeroMin < 0xFFFF ) ++gSignalStats->nearZeroMin;
+    }
+    
+    if( period < (kONE_Max+kZERO_Min)/2 )
+    {
+        SignalAnalyzer_Add(gSignalStats->oneHalf, ((int)period-kSIGNAL_ONE_BASE) >> 1);
+    }else{
+        SignalAnalyzer_Add(gSignalStats->zeroHalf, (period < 0x7FFF) ? ((int)period-kSIGNAL_ZERO_BASE) >> 3 : kSIGNAL_BINS);
+    }
+}
+
+void DCC_Decoder::SignalAnalyzer_Bit(unsigned int periodA, unsigned int periodB)
+{
+    SignalAnalyzer_Half(periodA);
+    SignalAnalyzer_Half(periodB);
+    
+        // Asymmetry of one bits. Orient by phase so the sign always refers to the same track polarity.
+    if( periodA >= kONE_Min && periodA <= kONE_Max && periodB >= kONE_Min && periodB <= kONE_Max )
+    {
+        int diff = gInterruptPhase ? (int)periodB-(int)periodA : (int)periodA-(int)periodB;
+        SignalAnalyzer_Add(gSignalStats->asymmetry, (diff + kSIGNAL_BINS) >> 1);
+        gSignalStats->dcOffset16 += ((diff<<4) - gSignalStats->dcOffset16) / 16;
+    }
+}
+
+void DCC_Decoder::SignalAnalyzer_Preamble(int count)
+{
+    SignalAnalyzer_Add(gSignalStats->preamble, count-kSIGNAL_PREAMBLE_BASE);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -461,8 +1315,17 @@ void DCC_Decoder::State_Execute()
             }                                                               \
             unsigned int periodA = gInterruptTime[0];                       \
             unsigned int periodB = gInterruptTime[1];                       \
+            gLastBitMicros = gInterruptBitMicros;                           \
             gLastChaos = gInterruptChaos;                                   \
             interrupts();                                                   \
+            if( gSignalStats )                                              \
+            {                                                               \
+                SignalAnalyzer_Bit(periodA, periodB);                       \
+            }                                                               \
+            if( gCutoutWatch && CutoutCheck(periodA, periodB) )             \
+            {                                                               \
+                return;                                                     \
+            }                                                               \
             boolean aIs1 = ( periodA >= kONE_Min && periodA <= kONE_Max );  \
             if( !aIs1 && (periodA < kZERO_Min || periodA > kZERO_Max) )     \
             {                                                               \
@@ -474,6 +1337,36 @@ void DCC_Decoder::State_Execute()
                 GOTO_DecoderReset( kDCC_ERR_NOT_0_OR_1 );                   \
             }                                                               \
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// RailCom cutout check. Called for the first bit after a packet end bit. A RailCom command station stops driving the track
+// for ~450us. That shows up as one long half period, or a short half period (end bit to cutout start) followed by a long one.
+// Returns true if the cutout was consumed. Preamble count is untouched.
+//
+boolean DCC_Decoder::CutoutCheck(unsigned int periodA, unsigned int periodB)
+{
+    gCutoutWatch = false;
+    
+    if( periodA >= kCUTOUT_Min && periodA <= kCUTOUT_Max )
+    {
+            // periodB is the first half of the next preamble bit.
+        gCutoutDetected = true;
+        ShiftInterruptAlignment();
+        return true;
+    }
+    
+    if( periodA < kONE_Min && (periodA+periodB) >= kCUTOUT_Min && (periodA+periodB) <= kCUTOUT_Max )
+    {
+            // periodA ends on the cutout start edge
+        gCutoutStartMicros = gPacketEndMicros + periodA;
+        gCutoutDetected = true;
+        return true;
+    }
+    
+    return false;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -510,6 +1403,7 @@ void DCC_Decoder::State_ReadPacket()
             if( aIs1 )
             {
                 gPacketEndedWith1 = true;
+                gPacketEndMicros = gLastBitMicros;
                 if( gPacketIndex>=kPACKET_LEN_MIN && gPacketIndex<=kPACKET_LEN_MAX )
                 {
                     GOTO_ExecutePacket();
@@ -524,6 +1418,9 @@ void DCC_Decoder::State_ReadPacket()
             }
         }
     }else{
+        // Halves disagree. periodB may be the first half of the next bit, so realign on it. It'll be read 
+        // again as the next periodA.
+        ShiftInterruptAlignment();
         GOTO_DecoderReset( kDCC_ERR_NOT_0_OR_1 );
     }
 }
@@ -552,17 +1449,161 @@ void DCC_Decoder::State_ReadPreamble()
             if( gPreambleCount >= kPREAMBLE_MIN )
             { 
                 // BANG! Read preamble plus trailing 0. Go read the packet.
+                if( gSignalStats )
+                {
+                    SignalAnalyzer_Preamble(gPreambleCount);
+                }
                 GOTO_ReadPacketState();
             }
         }else{
             // One is 0 the other 1. Shift alignment.
             ShiftInterruptAlignment();  
+            
+            // A 1 then 0 is a preamble read a half bit off, running into the packet start bit. periodB 
+            // begins the start bit so keep the preamble count.
+            if( aIs1 )
+            {
+                return;
+            }
         }
         // Not enough bits in preamble or shifted alignment. Start over at zero preamble.
         gPreambleCount = 0;
     }  
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Flight recorder. State_Reset logs each packet or error into a ring of records.
+//
+DCCFlightRecord* DCC_Decoder::gRecorder = NULL;
+byte             DCC_Decoder::gRecorderCount = 0;
+byte             DCC_Decoder::gRecorderNext = 0;
+byte             DCC_Decoder::gRecorderUsed = 0;
+byte             DCC_Decoder::gRecorderTriggerErrors = 0;
+byte             DCC_Decoder::gRecorderPostTrigger = 0;
+byte             DCC_Decoder::gRecorderErrorRun = 0;
+byte             DCC_Decoder::gRecorderStopIn = kRECORDER_ARMED;
+boolean          DCC_Decoder::gRecorderFrozen = false;
+
+void DCC_Decoder::SetFlightRecorder(DCCFlightRecord* records, byte count, byte triggerErrors, byte postTrigger)
+{
+    gRecorder = NULL;
+    gRecorderCount = count;
+    gRecorderTriggerErrors = triggerErrors;
+    gRecorderPostTrigger = (postTrigger < kRECORDER_ARMED) ? postTrigger : kRECORDER_ARMED-1;
+    RearmFlightRecorder();
+    gRecorder = (count ? records : NULL);
+}
+
+void DCC_Decoder::TriggerFlightRecorder()
+{
+    if( gRecorderStopIn == kRECORDER_ARMED )
+    {
+        gRecorderStopIn = gRecorderPostTrigger;
+        gRecorderFrozen = (gRecorderStopIn == 0);
+    }
+}
+
+void DCC_Decoder::RearmFlightRecorder()
+{
+    gRecorderNext = 0;
+    gRecorderUsed = 0;
+    gRecorderErrorRun = 0;
+    gRecorderStopIn = kRECORDER_ARMED;
+    gRecorderFrozen = false;
+}
+
+boolean DCC_Decoder::FlightRecorderFrozen()
+{
+    return gRecorderFrozen;
+}
+
+DCCFlightRecord* DCC_Decoder::FlightRecorderEntry(byte age)
+{
+    if( !gRecorder || age >= gRecorderUsed )
+    {
+        return NULL;
+    }
+    int index = (int)gRecorderNext - 1 - age;
+    return &gRecorder[ (index < 0) ? index + gRecorderCount : index ];
+}
+
+void DCC_Decoder::DumpFlightRecorder(Print& out)
+{
+    char buffer[60];
+    
+    for(int age=(int)gRecorderUsed-1; age>=0; --age)
+    {
+        DCCFlightRecord* record = FlightRecorderEntry(age);
+        out.print(record->micros);
+        out.print(" ");
+        out.print(ResultString(record->result));
+        out.print(" P:");
+        out.print(record->preambleBits);
+        out.print(" ");
+        for(byte i=0; i<record->length; ++i)
+        {
+            out.print(record->data[i], HEX);
+            out.print(" ");
+        }
+        if( record->length >= kPACKET_LEN_MIN )
+        {
+            out.print(MakePacketString(buffer, record->length, record->data));
+        }
+        out.println();
+    }
+}
+
+void DCC_Decoder::FlightRecorder_Log()
+{
+    if( gRecorderFrozen || gResetReason == kDCC_OK_BOOT )
+    {
+        return;
+    }
+    
+    DCCFlightRecord* record = &gRecorder[gRecorderNext];
+    record->micros = gLastBitMicros;
+    record->result = gResetReason;
+    record->preambleBits = (gPreambleCount < 0xFF) ? gPreambleCount : 0xFF;
+    record->length = gPacketIndex + ((gPacketMask!=0x80 && gPacketIndex<kPACKET_LEN_MAX) ? 1 : 0);
+    memcpy(record->data, gPacket, kPACKET_LEN_MAX);
+    
+    if( ++gRecorderNext >= gRecorderCount )
+    {
+        gRecorderNext = 0;
+    }
+    if( gRecorderUsed < gRecorderCount )
+    {
+        ++gRecorderUsed;
+    }
+    
+        // Counting down post trigger records
+    if( gRecorderStopIn != kRECORDER_ARMED )
+    {
+        if( --gRecorderStopIn == 0 )
+        {
+            gRecorderFrozen = true;
+        }
+        return;
+    }
+    
+        // Error burst trigger
+    if( gResetReason > kDCC_OK_MAX )
+    {
+        if( gRecorderErrorRun < 0xFF )
+        {
+            ++gRecorderErrorRun;
+        }
+        if( gRecorderTriggerErrors && gRecorderErrorRun >= gRecorderTriggerErrors )
+        {
+            DCC.TriggerFlightRecorder();
+        }
+    }else{
+        gRecorderErrorRun = 0;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -577,12 +1618,24 @@ void DCC_Decoder::State_Reset()
     }
     gHandledAsRawPacket = false;
     
+        // Log to flight recorder before packet data is cleared
+    if( gRecorder )
+    {
+        FlightRecorder_Log();
+    }
+    
         // If reset with an OK code, this was a valid packet. Save off times
     if( gResetReason < kDCC_OK_MAX )
     {
         // Save MS of last valid packet
         gLastValidPacketMS = gThisPacketMS;
         
+        // First packet since boot?
+        if( !gFirstPacketMicros && gResetReason!=kDCC_OK_BOOT )
+        {
+            gFirstPacketMicros = gPacketEndMicros;
+        }
+        
         // Save off other times
         switch( gResetReason )
         {
@@ -603,6 +1656,11 @@ void DCC_Decoder::State_Reset()
             default:
                 break;
         }
+        
+        if( gAddressStats )
+        {
+            UpdateAddressStatistics();
+        }
     }
     
         // Reset packet data
@@ -616,6 +1674,11 @@ void DCC_Decoder::State_Reset()
     gLastChaos = gInterruptChaos = 0;
     interrupts();
     
+        // After an end bit watch for a RailCom cutout
+    gCutoutWatch = gPacketEndedWith1;
+    gCutoutDetected = false;
+    gCutoutStartMicros = gPacketEndMicros;
+    
         // Clear packet ended 1 flag
     gPacketEndedWith1 = false;
     
@@ -640,6 +1703,10 @@ void DCC_Decoder::SetupDecoder(byte mfgID, byte mfgVers, byte interrupt)
         gCV[kCV_ManufacturerVersionNo] = mfgID;
         gCV[kCV_ManufacturedID] = mfgVers;
         
+            // Precompute derived state so the first packet can be acted on
+        Address_Build();
+        SpeedEngine_Build();
+        
             // Attach the DCC interrupt
         StartInterrupt(interrupt);
     
@@ -660,6 +1727,97 @@ void DCC_Decoder::SetupMonitor(byte interrupt)
     }
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Cooperative task scheduler. Once the next bit completes the decoder must read it before the following edge overwrites
+// its first half in gInterruptTime[0]. From the last edge that is 3 half periods away (2 after an alignment shift left
+// one half waiting), each at least kONE_Min long.
+//
+DCCTask*        DCC_Decoder::gTasks = NULL;
+byte            DCC_Decoder::gTaskCount = 0;
+byte            DCC_Decoder::gTaskNext = 0;
+
+void DCC_Decoder::SetTasks(DCCTask* tasks, byte count)
+{
+    gTasks = NULL;
+    for(byte i=0; i<count; ++i)
+    {
+        tasks[i].lastMS = millis() - tasks[i].periodMS;
+        tasks[i].overruns = 0;
+    }
+    gTaskCount = count;
+    gTaskNext = 0;
+    gTasks = (count ? tasks : NULL);
+}
+
+unsigned long DCC_Decoder::DecoderSlackMicros()
+{
+        // Decoder has work waiting?
+    if( gState!=DCC_Decoder::State_ReadPreamble && gState!=DCC_Decoder::State_ReadPacket )
+    {
+        return 0;
+    }
+    
+    noInterrupts();
+    boolean       pending = (gInterruptChaos != gLastChaos);
+    unsigned long lastEdge = gInterruptMicros;
+    byte          index = gInterruptTimeIndex;
+    interrupts();
+    
+    if( pending )
+    {
+        return 0;
+    }
+    
+    unsigned long now = EdgeMicros();
+    if( now - lastEdge > kTASK_NO_SIGNAL_MICROS )
+    {
+        return 0xFFFFFFFF;      // No signal, no deadline
+    }
+    
+    unsigned long deadline = (3 - index) * kONE_Min;
+    unsigned long elapsed = now - lastEdge;
+    if( elapsed + kTASK_MARGIN_MICROS >= deadline )
+    {
+        return 0;
+    }
+    return deadline - kTASK_MARGIN_MICROS - elapsed;
+}
+
+void DCC_Decoder::Tasks_Run()
+{
+    unsigned long slack = DCC.DecoderSlackMicros();
+    if( !slack )
+    {
+        return;
+    }
+    
+    unsigned long now = millis();
+    for(byte n=0; n<gTaskCount; ++n)
+    {
+        byte i = gTaskNext;
+        if( ++gTaskNext >= gTaskCount )
+        {
+            gTaskNext = 0;
+        }
+        
+        DCCTask* task = &gTasks[i];
+        if( task->func && task->budgetMicros<=slack && (now - task->lastMS) >= task->periodMS )
+        {
+            task->lastMS = now;
+            
+            unsigned long start = DCC.EdgeMicros();
+            (task->func)();
+            if( DCC.EdgeMicros() - start > task->budgetMicros && task->overruns < 0xFFFF )
+            {
+                ++task->overruns;
+            }
+            return;
+        }
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -667,7 +1825,29 @@ void DCC_Decoder::SetupMonitor(byte interrupt)
 //
 void DCC_Decoder::loop()
 {
+#if defined(DCC_TIMESTAMP_TIMER1)
+    if( !gInterruptInjected )
+    {
+        EdgeClock_Sync();
+    }
+#endif
     (gState)();
+    
+    if( func_SpeedOutput && (millis() - gSpeedTickMS) >= kSPEED_TICK_MS )
+    {
+        gSpeedTickMS += kSPEED_TICK_MS;
+        SpeedEngine_Step(true);
+    }
+    
+    if( gAccOutputs )
+    {
+        AccOutput_Loop();
+    }
+    
+    if( gTasks )
+    {
+        Tasks_Run();
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -700,6 +1880,7 @@ DCC_Decoder::ResultString(byte resultCode)
         "OK - Handled baseline",
         "OK - Handled basic accessory",
         "OK - Handled extended accessory",
+        "OK - Filtered",
     };
 
     static const char PROGMEM* const gErrors[] =
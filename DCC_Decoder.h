@@ -10,6 +10,32 @@
 
 #include "Arduino.h"
 
+///////////////////////////////////////////////////////////////////////////////////////
+
+    // NMRA DCC Definitions. Microsecond 0 & 1 half period timings 
+#define kONE_Min                      52
+#define kONE_Max                      64
+
+#define kZERO_Min                     90
+#define kZERO_Max                     10000
+
+    // Minimum preamble length
+#define kPREAMBLE_MIN                 10
+
+    // RailCom cutout. Microseconds from the packet end bit's last edge to the first edge after the cutout
+#define kCUTOUT_Min                   400
+#define kCUTOUT_Max                   560
+
+    // Edge timestamp source. Define to have the interrupt read the free running Timer1 counter (prescaler 8, 
+    // 0.5us ticks at 16MHz) with 16 bit wraparound instead of calling micros(). Timer1 is then unavailable to 
+    // Servo and analogWrite on its pins. Without a Timer1 (host builds) a stand-in counter derived from micros() is used.
+    // Timestamps stay on the micros() time base. loop() re-anchors the clock so gaps longer than a counter wrap 
+    // (32.768ms) without edges aren't lost.
+//#define DCC_TIMESTAMP_TIMER1
+
+    // Pass as interrupt to SetupXXX to run without attaching an interrupt. Edges come from InjectHalfPeriod
+#define kDCC_NO_INTERRUPT             0xFF
+
 ///////////////////////////////////////////////////////////////////////////////////////
 
 #define kDCC_STOP_SPEED     0xFE
@@ -19,12 +45,16 @@
 #define kCV_PrimaryAddress            1
 #define kCV_Vstart                    2
 #define kCV_AccelerationRate          3
-#define kCV_Deceleration Rate         4
+#define kCV_DecelerationRate          4
+#define kCV_Vhigh                     5
+#define kCV_Vmid                      6
 #define kCV_ManufacturerVersionNo     7 
 #define kCV_ManufacturedID            8
 #define kCV_ExtendedAddress1          17
 #define kCV_ExtendedAddress2          18
 #define kCV_ConfigurationData1        29
+#define kCV_SpeedTableFirst           67
+#define kCV_SpeedTableLast            94
 
     // Accessory Decoders
 #define kCV_AddressLSB                1
@@ -41,6 +71,7 @@
 #define kDCC_OK_BASELINE              6 
 #define kDCC_OK_BASIC_ACCESSORY       7 
 #define kDCC_OK_EXTENDED_ACCESSORY    8
+#define kDCC_OK_FILTERED              9
 #define kDCC_OK_MAX                   99
 
 #define kDCC_ERR_DETECTION_FAILED     100
@@ -58,6 +89,52 @@
     // CV 1..256 are supported
 #define kCV_MAX                       257
 
+    // CV snapshot
+#define kCV_SNAPSHOT_MAGIC            0xDC
+#define kCV_SNAPSHOT_HEADER           5           // Magic, CV count (MSB, LSB), Fletcher-16 checksum
+#define kCV_SNAPSHOT_SIZE             (kCV_SNAPSHOT_HEADER+kCV_MAX)   // Storage bytes a snapshot uses
+
+    // Speed engine
+#define kSPEED_STEPS                  28          // Speed table covers 0..28. 14 step packets use every other entry
+#define kSPEED_TICK_MS                8           // Milliseconds between momentum updates
+
+    // Flight recorder
+#define kRECORDER_ARMED               0xFF
+
+    // Packet filter
+#define kDCC_FILTER_ACCEPT            0
+#define kDCC_FILTER_REJECT            1
+#define kDCC_FILTER_BYTES             3           // Leading packet bytes a rule can test
+
+    // Signal analyzer histograms
+#define kSIGNAL_BINS                  16
+#define kSIGNAL_ONE_BASE              40          // oneHalf bins are 2us wide starting at 40us
+#define kSIGNAL_ZERO_BASE             80          // zeroHalf bins are 8us wide starting at 80us
+#define kSIGNAL_PREAMBLE_BASE         10          // preamble bins are 1 bit wide starting at 10 bits
+#define kSIGNAL_NEAR                  2           // Microseconds from a threshold counted as near
+
+    // Task scheduler
+#define kTASK_MARGIN_MICROS           24          // Decoder step time kept free ahead of each bit deadline
+#define kTASK_NO_SIGNAL_MICROS        20000       // No edge for this long means no deadline
+
+    // Address kinds for refresh statistics
+#define kDCC_ADDR_SHORT               1           // Multifunction 7 bit address
+#define kDCC_ADDR_LONG                2           // Multifunction 14 bit address
+#define kDCC_ADDR_BASIC_ACC           3           // Basic accessory board address
+#define kDCC_ADDR_EXTD_ACC            4           // Extended accessory address
+
+    // Accessory output modes (see SetAccessoryOutputs)
+#define kACC_OUTPUT_LATCH             0           // Output follows packets. No timing
+#define kACC_OUTPUT_PULSE             1           // On for durationMS then auto off
+#define kACC_OUTPUT_FLASH             2           // Toggle every durationMS while activated
+
+    // Accessory output timer wheel
+#define kACC_WHEEL_SLOTS              16          // Must be a power of 2
+#define kACC_WHEEL_SHIFT              4           // log2(kACC_WHEEL_SLOTS)
+#define kACC_WHEEL_TICK_MS            8           // Milliseconds per wheel slot
+#define kACC_WHEEL_SLICE              4           // Max slots advanced per call to loop()
+#define kACC_WHEEL_NONE               0xFF
+
 ///////////////////////////////////////////////////////////////////////////////////////
 
 typedef boolean (*RawPacket)(byte byteCount, byte* packetBytes);
@@ -71,6 +148,88 @@ typedef void (*ExtendedAccDecoderPacket)(int address, byte data);
 
 typedef void (*DecodingEngineCompletion)(byte resultOfLastPacket);
 
+typedef void (*RailComCutout)(byte byteCount, byte* packetBytes, unsigned long cutoutStartMicros);
+
+typedef void (*AccessoryOutputAction)(byte outputIndex, boolean on);
+
+typedef void (*SpeedOutput)(byte level, boolean forward);
+
+typedef void (*CVSnapshotIO)(int offset, byte* data, int length);
+
+typedef void (*DecoderTask)();
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct
+{
+    int               address;                // Output address. Basic: human form 1..2044. Extended: packet address
+    boolean           isExtended;             // true=driven by extended accessory packets, false=basic
+    byte              mode;                   // kACC_OUTPUT_LATCH, kACC_OUTPUT_PULSE or kACC_OUTPUT_FLASH
+    unsigned int      durationMS;             // Pulse length or flash half period. 0 means latch
+    
+    boolean           active;                 // Used internally for timing
+    boolean           on;                     // 
+    byte              wheelSlot;              // 
+    byte              wheelNext;              // 
+    byte              wheelPrev;              // 
+    unsigned int      wheelRounds;            // 
+} DCCAccessoryOutput;
+
+typedef struct
+{
+    int               address;                // Address this entry tracks
+    byte              kind;                   // kDCC_ADDR_xxx. 0 means empty entry
+    unsigned int      packets;                // Packets seen (saturates)
+    unsigned int      intervals;              // Intervals summed in totalMicros
+    unsigned long     lastMicros;             // End bit micros of last packet
+    unsigned long     lastIntervalMicros;     // Most recent refresh interval
+    unsigned long     minMicros;              // Shortest refresh interval
+    unsigned long     maxMicros;              // Longest refresh interval
+    unsigned long     totalMicros;            // Sum of intervals. See MeanRefreshMicros
+    unsigned long     jitterMicros;           // Smoothed |interval - previous interval|, gain 1/16
+} DCCAddressStats;
+
+typedef struct
+{
+    DecoderTask       func;                       // Task slice to run
+    unsigned int      budgetMicros;               // Longest one slice may take
+    unsigned int      periodMS;                   // Minimum milliseconds between slices. 0 = whenever there is time
+    
+    unsigned long     lastMS;                     // Used internally
+    unsigned int      overruns;                   // Slices that took longer than budgetMicros
+} DCCTask;
+
+typedef struct
+{
+    unsigned long     micros;                     // Edge micros of the last bit read (end bit for packets)
+    byte              result;                     // kDCC_OK_xxx or kDCC_ERR_xxx
+    byte              preambleBits;               // Preamble bit count
+    byte              length;                     // Packet bytes read, including a partial last byte
+    byte              data[kPACKET_LEN_MAX];      // Packet bytes as read
+} DCCFlightRecord;
+
+typedef struct
+{
+    byte              length;                     // Packet length including error byte
+    byte              mask[kDCC_FILTER_BYTES];    // Bits to test in the leading packet bytes
+    byte              value[kDCC_FILTER_BYTES];   // Required value of the masked bits
+    byte              action;                     // kDCC_FILTER_ACCEPT or kDCC_FILTER_REJECT
+} DCCPacketFilterRule;
+
+typedef struct
+{
+    unsigned long     halfPeriods;                // Half periods analyzed
+    unsigned int      oneHalf[kSIGNAL_BINS];      // Half periods in the one region. 2us bins from kSIGNAL_ONE_BASE
+    unsigned int      zeroHalf[kSIGNAL_BINS];     // Half periods in the zero region. 8us bins from kSIGNAL_ZERO_BASE
+    unsigned int      asymmetry[kSIGNAL_BINS];    // First minus second half of one bits. 2us bins, bin 8 is 0..1us
+    unsigned int      preamble[kSIGNAL_BINS];     // Preamble lengths. 1 bit bins from kSIGNAL_PREAMBLE_BASE
+    int               dcOffset16;                 // Smoothed one bit asymmetry (DC offset) in 1/16us
+    unsigned int      nearOneMin;                 // Half periods within kSIGNAL_NEAR of each threshold
+    unsigned int      nearOneMax;                 // 
+    unsigned int      nearZeroMin;                // 
+    unsigned int      outOfRange;                 // Half periods that are neither one nor zero
+} DCCSignalStats;
+
 ///////////////////////////////////////////////////////////////////////////////////////
 
 typedef void(*StateFunc)();
@@ -86,9 +245,24 @@ public:
     void SetupDecoder(byte mfgID, byte mfgVers, byte interrupt);    // Used for Decoder
     void SetupMonitor(byte interrupt);                              // Used when building a monitor
     
+        // Fast power on. Loads all CVs from a checksummed snapshot with readFunc (e.g. one EEPROM block read),
+        // then calls SetupDecoder. Returns false and starts with blank CVs if the snapshot is missing or bad.
+        // SaveCVSnapshot writes the current CVs with writeFunc. Offsets are relative to the snapshot's storage.
+    boolean SetupDecoderFromSnapshot(byte mfgID, byte mfgVers, byte interrupt, CVSnapshotIO readFunc);
+    void SaveCVSnapshot(CVSnapshotIO writeFunc);
+    
         // All packets are sent to RawPacketHandler. Return true to stop dispatching to other handlers.
     void SetRawPacketHandler(RawPacket func);
     
+        // Packet filter. Rules are checked before any handler is called except the RailCom cutout handler, which 
+        // sees every packet that passes error detection. The first rule matching the packet's length and leading 
+        // bytes decides. No match uses defaultAction. Rejected packets finish with kDCC_OK_FILTERED.
+        // rules is sorted by length in place and must stay valid while the filter is set. Pass NULL to clear.
+    void SetPacketFilter(DCCPacketFilterRule* rules, byte count, byte defaultAction);
+        // Fills rules with the mask/value blocks covering long addresses first..last. Returns number of rules used.
+    byte MakeLongAddressFilterRules(DCCPacketFilterRule* rules, byte maxRules, int first, int last, 
+                                    byte instructionMask, byte instructionValue, byte length, byte action);
+    
         // S 9.2 defines two special packets. Idle and reset.
     void SetIdlePacketHandler(IdleResetPacket func);
     void SetResetPacketHandler(IdleResetPacket func);
@@ -100,6 +274,17 @@ public:
     void SetBasicAccessoryDecoderPacketHandler(BasicAccDecoderPacket func, boolean allPackets);
     void SetExtendedAccessoryDecoderPacketHandler(ExtendedAccDecoderPacket func, boolean allPackets);
                 
+        // Speed engine for motor decoders. Baseline packets to this decoder's address set a target from a speed table
+        // built from CV2/5/6 (or CV67-94 when CV29 bit 4 is set). loop() moves toward it at the CV3/CV4 momentum rates
+        // and calls func with the new output level (0-255) whenever it changes.
+    void SetSpeedOutputHandler(SpeedOutput func);
+    
+        // Timed accessory outputs. Basic and extended accessory packets matching an output's address
+        // switch it and schedule pulse/flash timing. func is called with the output's index on each change.
+        // Basic packets only act with the activate bit (C) set. Deactivate packets are ignored; pulse outputs
+        // turn off on their own timer.
+    void SetAccessoryOutputs(DCCAccessoryOutput* outputs, byte count, AccessoryOutputAction func);
+                
         // Read/Write CVs
     byte ReadCV(int cv);
     void WriteCV(int cv, byte data);
@@ -107,6 +292,20 @@ public:
         // Helper function to read decoder address
     int Address();
     
+        // Current time on the clock edges are stamped with. micros() unless DCC_TIMESTAMP_TIMER1 is defined.
+    unsigned long EdgeMicros();
+    
+        // Feed one half period to the decoder as if the interrupt had seen it. For loopback testing with DCC_Encoder.
+        // Injected edges run a virtual clock: from the first call EdgeMicros() returns the last injected edge's time.
+    void InjectHalfPeriod(unsigned int periodMicros);
+    
+        // Cooperative tasks. loop() runs at most one task slice per call, and only when the slice's budget fits
+        // before the decoder has to read the next bit. Tasks must do a small piece of work and return. With a
+        // signal present there is at most 3*kONE_Min-kTASK_MARGIN_MICROS (132us) for a slice.
+    void SetTasks(DCCTask* tasks, byte count);
+        // Microseconds that can be spent now before the decoder must run again. 0 if it must run now.
+    unsigned long DecoderSlackMicros();
+    
         // Call at least once from mainloop. Not calling frequently enough and library will miss data bits!
     void loop();
     
@@ -121,12 +320,48 @@ public:
     unsigned long MillisecondsSinceLastPacketToThisDecoder();
     unsigned long MillisecondsSinceLastIdlePacket();
     unsigned long MillisecondsSinceLastResetPacket();
+        // Microseconds from SetupXXX to the end bit of the first valid packet. 0 until one arrives.
+    unsigned long MicrosecondsFromBootToFirstPacket();
+    
+        // Per address refresh statistics. Every valid packet to a multifunction or accessory address updates
+        // its entry in table. When the table is full the least recently seen address is replaced.
+    void SetAddressStatisticsTable(DCCAddressStats* table, byte count);
+    unsigned long MeanRefreshMicros(DCCAddressStats* stats);
+    
+        // RailCom support. Handler is called as soon as a packet passes error detection, before any other handler.
+        // The cutout hasn't happened yet, so cutoutStartMicros is the EdgeMicros() time of the packet end bit's last
+        // edge. The cutout opens 26-32us after it.
+    void SetRailComCutoutHandler(RailComCutout func);
+        // After a cutout: EdgeMicros() time of the cutout start edge if the command station drove one (short half
+        // period then the cutout), otherwise the packet end bit edge as above.
+    unsigned long CutoutStartMicros();
+        // True once the gap after the last packet was recognised as a cutout.
+    boolean CutoutDetected();
     
     
     //=======================   Debugging   =======================//    
+        // Streaming signal quality analyzer. Every half period read is added to stats. Histograms halve 
+        // themselves when a bin fills, so memory is constant. Pass NULL to stop.
+    void SetSignalAnalyzer(DCCSignalStats* stats);
+    
+
         // Everytime the DCC Decoder engine starts looking for preamble bits this will be 
         // called with result of last packet. (Debugging)
     void SetDecodingEngineCompletionStatusHandler(DecodingEngineCompletion func);
+        // Flight recorder. Every packet and error is logged to a ring of count records. After triggerErrors errors 
+        // with no valid packet between (0=never), postTrigger more are logged and then the ring freezes until rearmed.
+    void SetFlightRecorder(DCCFlightRecord* records, byte count, byte triggerErrors, byte postTrigger);
+    void TriggerFlightRecorder();
+    void RearmFlightRecorder();
+    boolean FlightRecorderFrozen();
+        // Record from newest (age 0) back. NULL if there is no record that old.
+    DCCFlightRecord* FlightRecorderEntry(byte age);
+        // Print records oldest to newest
+    void DumpFlightRecorder(Print& out);
+        // Runs the edge interrupt handler edges times back to back and returns the microseconds taken. Decoder state 
+        // is restored afterwards. Only use with kDCC_NO_INTERRUPT so a real edge can't arrive meanwhile.
+    unsigned long InterruptCostMicros(unsigned int edges);
+    
         // Converts code passed into completionStatusHandler to human readable string.
     const char PROGMEM* ResultString(byte resultCode);
     
@@ -138,6 +373,16 @@ private:
     static void State_ReadPacket();
     static void State_Execute();
     static void State_Reset();
+    static boolean CutoutCheck(unsigned int periodA, unsigned int periodB);
+    static void UpdateAddressStatistics();
+    
+        // Signal analyzer
+    static void SignalAnalyzer_Bit(unsigned int periodA, unsigned int periodB);
+    static void SignalAnalyzer_Half(unsigned int period);
+    static void SignalAnalyzer_Preamble(int count);
+    static void SignalAnalyzer_Add(unsigned int* histogram, int bin);
+    
+    static DCCSignalStats*          gSignalStats;                // Analyzer stats supplied by sketch
     
         // Function pointers for the library callbacks
     static RawPacket                func_RawPacket;
@@ -153,12 +398,72 @@ private:
     static boolean                  func_BaselineControlPacket_All_Packets;
     
     static DecodingEngineCompletion func_DecodingEngineCompletion;
+    static RailComCutout            func_RailComCutout;
+    
+        // Task scheduler
+    static void Tasks_Run();
+    
+    static DCCTask*                 gTasks;                      // Tasks supplied by sketch
+    static byte                     gTaskCount;
+    static byte                     gTaskNext;                   // Round robin position
+    
+        // Flight recorder
+    static void FlightRecorder_Log();
+    
+    static DCCFlightRecord*         gRecorder;                   // Record ring supplied by sketch
+    static byte                     gRecorderCount;              // Records in ring
+    static byte                     gRecorderNext;               // Index to write next
+    static byte                     gRecorderUsed;               // Records written, up to gRecorderCount
+    static byte                     gRecorderTriggerErrors;      // Error run that triggers. 0=never
+    static byte                     gRecorderPostTrigger;        // Records kept after trigger
+    static byte                     gRecorderErrorRun;           // Errors since last valid packet
+    static byte                     gRecorderStopIn;             // Records left before freezing. kRECORDER_ARMED if not triggered
+    static boolean                  gRecorderFrozen;
+    
+        // Packet filter
+    static boolean PacketFilter_Accept();
+    
+    static DCCPacketFilterRule*     gFilterRules;                // Rules sorted by length
+    static byte                     gFilterStart[kPACKET_LEN_MAX+2]; // Index of first rule of each length
+    static byte                     gFilterDefault;              // Action when no rule matches
+    
+        // Speed engine
+    static void SpeedEngine_Build();
+    static void SpeedEngine_Packet(byte speed, boolean forward);
+    static void SpeedEngine_Step(boolean tick);
+    
+    static SpeedOutput              func_SpeedOutput;
+    static unsigned int             gSpeedTable[kSPEED_STEPS+1]; // Output level per speed step. 8.8 fixed point
+    static unsigned long            gSpeedAccelStep;             // Level change per tick. 8.16 fixed point. 0 = no momentum
+    static unsigned long            gSpeedDecelStep;             // 
+    static unsigned long            gSpeedCurrent;               // Current output level. 8.16 fixed point
+    static unsigned long            gSpeedTarget;                // Requested output level. 8.16 fixed point
+    static boolean                  gSpeedForward;               // Current direction
+    static boolean                  gSpeedForwardTarget;         // Requested direction
+    static byte                     gSpeedLevel;                 // Last level sent to func_SpeedOutput
+    static unsigned long            gSpeedTickMS;                // Milliseconds of last momentum tick
+    
+        // Accessory output scheduler
+    static void AccOutput_Packet(int address, boolean isExtended, boolean enable);
+    static void AccOutput_Set(byte index, boolean on);
+    static void AccOutput_Schedule(byte index, unsigned int ms);
+    static void AccOutput_Cancel(byte index);
+    static void AccOutput_Expire(byte index);
+    static void AccOutput_Loop();
+    
+    static AccessoryOutputAction    func_AccOutputAction;
+    static DCCAccessoryOutput*      gAccOutputs;                 // Output table supplied by sketch
+    static byte                     gAccOutputCount;
+    static byte                     gAccWheel[kACC_WHEEL_SLOTS]; // Head output index of each wheel slot
+    static byte                     gAccWheelSlot;               // Current wheel slot
+    static unsigned long            gAccWheelMS;                 // Milliseconds of current wheel slot
     
         // Current state function pointer
     static StateFunc                gState;                      // Current state function pointer
     
         // Timing data from last interrupt
     static unsigned int             gLastChaos;                  // Interrupt chaos count we processed
+    static unsigned long            gLastBitMicros;              // Microseconds of the edge that completed the last bit read
     
         // Preamble bit count
     static int                      gPreambleCount;              // Bit count for reading preamble
@@ -176,9 +481,28 @@ private:
                                                                  // CV Storage
     static byte                     gCV[kCV_MAX];                // CV Storage (TODO - Storage in PROGMEM)
     
+        // RailCom cutout
+    static unsigned long            gPacketEndMicros;            // Microseconds of last packet's end bit edge
+    static unsigned long            gCutoutStartMicros;          // Measured cutout start edge, else gPacketEndMicros
+    static boolean                  gCutoutWatch;                // Set after a packet end bit. Next bit may be a cutout
+    static boolean                  gCutoutDetected;             // Cutout seen after last packet
+    
+        // Derived CV state
+    static void Address_Build();
+    static unsigned int CVSnapshot_Checksum();
+    static int                      gDecoderAddress;             // Address() computed from CVs
+    
+        // Boot timing
+    static unsigned long            gBootMicros;                 // Microseconds at boot. Interrupt start, or SetupDecoderFromSnapshot entry
+    static unsigned long            gFirstPacketMicros;          // End bit microseconds of first valid packet. 0 until then
+    
         // Packet arrival timing
     static unsigned long            gThisPacketMS;               // Milliseconds of this packet being parsed
     static boolean                  gLastPacketToThisAddress;    // Was last pack processed to this decoder's address?
+    static int                      gThisPacketAddress;          // Accessory address decoded from this packet
+    
+    static DCCAddressStats*         gAddressStats;               // Refresh statistics table supplied by sketch
+    static byte                     gAddressStatsCount;
     
     static unsigned long            gLastValidPacketMS;          // Milliseconds of last valid packet
     static unsigned long            gLastValidPacketToAddressMS; // Milliseconds of last valid packet to this decoder
@@ -189,10 +513,20 @@ private:
         // Interrupt Support
     static void StartInterrupt(byte interrupt);    
     static void DCC_Interrupt();
+    static void RecordHalfPeriod(unsigned int period, unsigned long ms);
     static void ShiftInterruptAlignment();
+    static unsigned long EdgeClock_Sync();
     
-    static unsigned long          gInterruptMicros;
+    static unsigned long          gInterruptMicros;            // Time of last edge
+    static uint16_t               gInterruptTicks;             // DCC_TIMESTAMP_TIMER1: timer count of clock anchor
+    static uint16_t               gInterruptEdgeTicks;         //   timer count of last edge
+    static unsigned long          gInterruptTickMicros;        //   clock time at anchor
+    static unsigned long          gInterruptSyncMicros;        //   micros() at last EdgeClock_Sync
+    static unsigned long          gInterruptSyncTickMicros;    //   clock time at last EdgeClock_Sync
+    static volatile unsigned long gInterruptBitMicros;
     static byte                   gInterruptTimeIndex;
+    static byte                   gInterruptPhase;             // Flips on each alignment shift. Tracks which half is which polarity
+    static boolean                gInterruptInjected;          // Edges come from InjectHalfPeriod. EdgeMicros() follows them
     static volatile unsigned int  gInterruptTime[2];
     static volatile unsigned int  gInterruptChaos;
 };
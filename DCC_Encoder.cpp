@@ -0,0 +1,181 @@
+//
+// DCC_Encoder.cpp - NMRA DCC packet encoder. Companion to DCC_Decoder for loopback testing.
+// Released into the public domain.
+//
+
+#include "Arduino.h"
+#include "DCC_Encoder.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Constructor
+//
+DCC_Encoder::DCC_Encoder()
+{
+    mOneHalf = kENCODER_ONE_HALF;
+    mZeroHalf = kENCODER_ZERO_HALF;
+    mPreambleBits = kENCODER_PREAMBLE;
+    mJitter = 0;
+    mRandom = 1;
+    mCutout = 0;
+    mGapBits = 0;
+
+    mPacketLength = 0;
+    mPreambleLeft = 0;
+    mByteIndex = 0;
+    mMask = 0;
+    mEndSent = true;
+    mCutoutLeft = false;
+    mGapLeft = 0;
+    mSecondHalf = false;
+    mBitPeriod = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Timing setup
+//
+void DCC_Encoder::SetPreambleBits(byte bits)
+{
+    mPreambleBits = bits;
+}
+
+void DCC_Encoder::SetHalfPeriods(unsigned int oneMicros, unsigned int zeroMicros)
+{
+    mOneHalf = oneMicros;
+    mZeroHalf = zeroMicros;
+}
+
+void DCC_Encoder::SetJitter(byte jitterMicros, unsigned int seed)
+{
+    mJitter = jitterMicros;
+    mRandom = (uint16_t)seed ? seed : 1;
+}
+
+void DCC_Encoder::SetInterpacketGap(unsigned int cutoutMicros, byte extraOneBits)
+{
+    mCutout = cutoutMicros;
+    mGapBits = extraOneBits;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Packet loading
+//
+byte DCC_Encoder::ErrorByte(const byte* packetBytes, byte byteCount)
+{
+    byte errorDetection = 0;
+    for(byte i=0; i<byteCount; ++i)
+    {
+        errorDetection ^= packetBytes[i];
+    }
+    return errorDetection;
+}
+
+boolean DCC_Encoder::LoadPacket(const byte* packetBytes, byte byteCount)
+{
+    if( byteCount < kPACKET_LEN_MIN-1 || byteCount > kPACKET_LEN_MAX-1 )
+    {
+        return false;
+    }
+
+    memcpy(mPacket, packetBytes, byteCount);
+    mPacket[byteCount] = ErrorByte(packetBytes, byteCount);
+    mPacketLength = byteCount+1;
+
+    mPreambleLeft = mPreambleBits;
+    mByteIndex = 0;
+    mMask = 0;
+    mEndSent = false;
+    mCutoutLeft = (mCutout != 0);
+    mGapLeft = mGapBits;
+    mSecondHalf = false;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Half period generation. Each bit is two equal half periods (before jitter).
+//
+unsigned int DCC_Encoder::Jitter(unsigned int period)
+{
+    if( !mJitter )
+    {
+        return period;
+    }
+
+        // xorshift16
+    mRandom ^= mRandom << 7;
+    mRandom ^= mRandom >> 9;
+    mRandom ^= mRandom << 8;
+
+    unsigned int offset = mRandom % (2*mJitter+1);
+    return (period + offset > mJitter) ? period + offset - mJitter : 1;
+}
+
+unsigned int DCC_Encoder::NextHalfPeriod()
+{
+    if( mSecondHalf )
+    {
+        mSecondHalf = false;
+        return Jitter(mBitPeriod);
+    }
+
+    boolean bit;
+    if( mPreambleLeft )
+    {
+        --mPreambleLeft;
+        bit = true;
+    }else if( mMask ){
+            // Data bit
+        bit = (mPacket[mByteIndex] & mMask) ? true : false;
+        mMask >>= 1;
+        if( !mMask )
+        {
+            ++mByteIndex;
+        }
+    }else if( mByteIndex < mPacketLength ){
+            // Data start bit
+        mMask = 0x80;
+        bit = false;
+    }else if( !mEndSent ){
+            // Packet end bit
+        mEndSent = true;
+        bit = true;
+    }else if( mCutoutLeft ){
+            // Cutout is one long half period
+        mCutoutLeft = false;
+        return mCutout;
+    }else if( mGapLeft ){
+        --mGapLeft;
+        bit = true;
+    }else{
+        return 0;
+    }
+
+    mBitPeriod = bit ? mOneHalf : mZeroHalf;
+    mSecondHalf = true;
+    return Jitter(mBitPeriod);
+}
+
+unsigned int DCC_Encoder::Encode(unsigned int* halfPeriods, unsigned int maxCount)
+{
+    unsigned int count = 0;
+    while( count < maxCount )
+    {
+        unsigned int period = NextHalfPeriod();
+        if( !period )
+        {
+            break;
+        }
+        halfPeriods[count++] = period;
+    }
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
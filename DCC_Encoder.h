@@ -0,0 +1,76 @@
+//
+// DCC_Encoder.h - NMRA DCC packet encoder. Companion to DCC_Decoder for loopback testing.
+// Turns packet bytes into the half period sequence a command station would put on the track.
+// Released into the public domain.
+//
+
+#ifndef __DCC_ENCODER_H__
+#define __DCC_ENCODER_H__
+
+#include "Arduino.h"
+#include "DCC_Decoder.h"
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+    // Nominal timings. Mirror the decoder's limits in DCC_Decoder.h
+#define kENCODER_ONE_HALF             ((kONE_Min+kONE_Max)/2)     // 58us
+#define kENCODER_ZERO_HALF            (kZERO_Min+10)              // 100us
+#define kENCODER_PREAMBLE             (kPREAMBLE_MIN+4)           // 14 bits, S 9.2 command station minimum
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+class DCC_Encoder
+{
+public:
+    DCC_Encoder();
+
+        // Timing setup. Defaults are the nominal values above, no jitter, no gap.
+    void SetPreambleBits(byte bits);
+    void SetHalfPeriods(unsigned int oneMicros, unsigned int zeroMicros);
+        // Each half period gets a uniform random offset of -jitterMicros..+jitterMicros
+    void SetJitter(byte jitterMicros, unsigned int seed);
+        // After the end bit: a cutoutMicros half period (RailCom style, 0=none) then extraOneBits of idle 1s
+    void SetInterpacketGap(unsigned int cutoutMicros, byte extraOneBits);
+
+        // Loads packet data bytes. Error detection byte is appended. Returns false if byteCount is out of range.
+    boolean LoadPacket(const byte* packetBytes, byte byteCount);
+
+        // Next half period in microseconds. Returns 0 once the packet and its gap are done.
+    unsigned int NextHalfPeriod();
+        // Fills halfPeriods with up to maxCount half periods. Returns count written.
+    unsigned int Encode(unsigned int* halfPeriods, unsigned int maxCount);
+
+        // XOR of packetBytes. The error detection byte for them.
+    static byte ErrorByte(const byte* packetBytes, byte byteCount);
+
+    //======================= Internals =======================//
+private:
+    unsigned int Jitter(unsigned int period);
+
+        // Timing
+    unsigned int    mOneHalf;
+    unsigned int    mZeroHalf;
+    byte            mPreambleBits;
+    byte            mJitter;
+    uint16_t        mRandom;                    // xorshift16 state. 16 bits on every target so runs repeat
+    unsigned int    mCutout;
+    byte            mGapBits;
+
+        // Packet
+    byte            mPacket[kPACKET_LEN_MAX];
+    byte            mPacketLength;
+
+        // Encoding position
+    byte            mPreambleLeft;              // Preamble bits still to send
+    byte            mByteIndex;                 // Byte being sent
+    byte            mMask;                      // Bit being sent. 0 means start or end bit is next
+    boolean         mEndSent;
+    boolean         mCutoutLeft;
+    byte            mGapLeft;
+    boolean         mSecondHalf;                // Next half period repeats mBitPeriod
+    unsigned int    mBitPeriod;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -9,19 +9,14 @@
 
 typedef struct
 {
-    int               address;                // Address to respond to
-    byte              output;                 // State of output 1=on, 0=off
     int               outputPin;              // Arduino output pin to drive
     boolean           isDigital;              // true=digital, false=analog. If analog must also set analogValue field
-    boolean           isFlasher;              // true=flash output, false=no time, no flash.
     byte              analogValue;            // Value to use with analog type.
-    int               durationMilli;          // Milliseconds to leave output on for.  0 means don't auto off
-    
-    unsigned long     onMilli;                // Used internally for timing
-    unsigned long     offMilli;               // 
-} DCCAccessoryAddress;
+} DCCAccessoryPin;
 
-DCCAccessoryAddress gAddresses[8];
+    // Library output table (address, timing) and matching pin table (how to drive it)
+DCCAccessoryOutput gOutputs[8];
+DCCAccessoryPin    gPins[8];
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -30,79 +25,97 @@ DCCAccessoryAddress gAddresses[8];
 //
 void ConfigureDecoder()
 {
-    gAddresses[0].address = 714;
-    gAddresses[0].output = 0;
-    gAddresses[0].outputPin = 5;
-    gAddresses[0].isDigital = false;
-    gAddresses[0].isFlasher = false;
-    gAddresses[0].analogValue = 250;
-    gAddresses[0].durationMilli = 500;
+    gOutputs[0].address = 714;
+    gOutputs[0].isExtended = false;
+    gOutputs[0].mode = kACC_OUTPUT_PULSE;
+    gOutputs[0].durationMS = 500;
+    gPins[0].outputPin = 5;
+    gPins[0].isDigital = false;
+    gPins[0].analogValue = 250;
+    
+    gOutputs[1].address = 715;
+    gOutputs[1].isExtended = false;
+    gOutputs[1].mode = kACC_OUTPUT_PULSE;
+    gOutputs[1].durationMS = 500;
+    gPins[1].outputPin = 6;
+    gPins[1].isDigital = true;
+    gPins[1].analogValue = 0;
     
-    gAddresses[1].address = 715;
-    gAddresses[1].output = 0;
-    gAddresses[1].outputPin = 6;
-    gAddresses[1].isDigital = true;
-    gAddresses[1].isFlasher = false;
-    gAddresses[1].analogValue = 0;
-    gAddresses[1].durationMilli = 500;
-        
-    gAddresses[2].address = 814;
-    gAddresses[2].output = 0;
-    gAddresses[2].outputPin = 5;
-    gAddresses[2].isDigital = false;
-    gAddresses[2].isFlasher = true;
-    gAddresses[2].analogValue = 250;
-    gAddresses[2].durationMilli = 500;
+    gOutputs[2].address = 814;
+    gOutputs[2].isExtended = false;
+    gOutputs[2].mode = kACC_OUTPUT_FLASH;
+    gOutputs[2].durationMS = 500;
+    gPins[2].outputPin = 5;
+    gPins[2].isDigital = false;
+    gPins[2].analogValue = 250;
     
-    gAddresses[3].address = 815;
-    gAddresses[3].output = 0;
-    gAddresses[3].outputPin = 6;
-    gAddresses[3].isDigital = true;
-    gAddresses[3].isFlasher = true;
-    gAddresses[3].analogValue = 0;
-    gAddresses[3].durationMilli = 500;
+    gOutputs[3].address = 815;
+    gOutputs[3].isExtended = false;
+    gOutputs[3].mode = kACC_OUTPUT_FLASH;
+    gOutputs[3].durationMS = 500;
+    gPins[3].outputPin = 6;
+    gPins[3].isDigital = true;
+    gPins[3].analogValue = 0;
     
-    gAddresses[4].address = 914;
-    gAddresses[4].output = 0;
-    gAddresses[4].outputPin = 5;
-    gAddresses[4].isDigital = false;
-    gAddresses[4].isFlasher = false;
-    gAddresses[4].analogValue = 250;
-    gAddresses[4].durationMilli = 0;
+    gOutputs[4].address = 914;
+    gOutputs[4].isExtended = false;
+    gOutputs[4].mode = kACC_OUTPUT_LATCH;
+    gOutputs[4].durationMS = 0;
+    gPins[4].outputPin = 5;
+    gPins[4].isDigital = false;
+    gPins[4].analogValue = 250;
     
-    gAddresses[5].address = 915;
-    gAddresses[5].output = 0;
-    gAddresses[5].outputPin = 6;
-    gAddresses[5].isDigital = true;
-    gAddresses[5].isFlasher = false;
-    gAddresses[5].analogValue = 0;
-    gAddresses[5].durationMilli = 0;
+    gOutputs[5].address = 915;
+    gOutputs[5].isExtended = false;
+    gOutputs[5].mode = kACC_OUTPUT_LATCH;
+    gOutputs[5].durationMS = 0;
+    gPins[5].outputPin = 6;
+    gPins[5].isDigital = true;
+    gPins[5].analogValue = 0;
     
-    gAddresses[6].address = 0;
-    gAddresses[6].output = 0;
-    gAddresses[6].outputPin = 0;
-    gAddresses[6].isDigital = false;
-    gAddresses[6].isFlasher = false;
-    gAddresses[6].analogValue = 0;
-    gAddresses[6].durationMilli = 0;
+    gOutputs[6].address = 0;
+    gOutputs[6].isExtended = false;
+    gOutputs[6].mode = kACC_OUTPUT_LATCH;
+    gOutputs[6].durationMS = 0;
+    gPins[6].outputPin = 0;
+    gPins[6].isDigital = false;
+    gPins[6].analogValue = 0;
     
-    gAddresses[7].address = 0;
-    gAddresses[7].output = 0;
-    gAddresses[7].outputPin = 0;
-    gAddresses[7].isDigital = false;
-    gAddresses[7].isFlasher = false;
-    gAddresses[7].analogValue = 0;
-    gAddresses[7].durationMilli = 0;
+    gOutputs[7].address = 0;
+    gOutputs[7].isExtended = false;
+    gOutputs[7].mode = kACC_OUTPUT_LATCH;
+    gOutputs[7].durationMS = 0;
+    gPins[7].outputPin = 0;
+    gPins[7].isDigital = false;
+    gPins[7].analogValue = 0;
     
         // Setup output pins
-    for(int i=0; i<(int)(sizeof(gAddresses)/sizeof(gAddresses[0])); i++)
+    for(int i=0; i<(int)(sizeof(gPins)/sizeof(gPins[0])); i++)
     {
-        if( gAddresses[i].outputPin )
+        if( gPins[i].outputPin )
         {
-            pinMode( gAddresses[i].outputPin, OUTPUT );
+            pinMode( gPins[i].outputPin, OUTPUT );
         }
-        gAddresses[i].onMilli = 0;
-        gAddresses[i].offMilli = 0;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Accessory output handler. Library calls this when an output turns on or off, including pulse ends and flashes.
+//
+void AccessoryOutput_Handler(byte outputIndex, boolean on)
+{
+    if( !gPins[outputIndex].outputPin )
+    {
+        return;
+    }
+    
+    if( gPins[outputIndex].isDigital )
+    {
+        digitalWrite( gPins[outputIndex].outputPin, on ? HIGH : LOW);
+    }else{
+        analogWrite( gPins[outputIndex].outputPin, on ? gPins[outputIndex].analogValue : 0);
     }
 }
 
@@ -120,29 +133,19 @@ void BasicAccDecoderPacket_Handler(int address, boolean activate, byte data)
     address += (data & 0x06) >> 1;
     
     boolean enable = (data & 0x01) ? 1 : 0;
-    
-    for(int i=0; i<(int)(sizeof(gAddresses)/sizeof(gAddresses[0])); i++)
+
+        // Only report our own addresses. Serial output for every accessory packet on the layout would stall decoding.
+    for(int i=0; i<(int)(sizeof(gOutputs)/sizeof(gOutputs[0])); i++)
     {
-        if( address == gAddresses[i].address )
+        if( address == gOutputs[i].address && !gOutputs[i].isExtended )
         {
             Serial.print("Basic addr: ");
             Serial.print(address,DEC);
             Serial.print("   activate: ");
             Serial.println(enable,DEC);
-            
-            if( enable )
-            {
-                gAddresses[i].output = 1;
-                gAddresses[i].onMilli = millis();
-                gAddresses[i].offMilli = 0;
-            }else{
-                gAddresses[i].output = 0;
-                gAddresses[i].onMilli = 0;
-                gAddresses[i].offMilli = millis();
-            }
+            break;
         }
     }
-    
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -155,6 +158,7 @@ void setup()
    Serial.begin(9600);
    DCC.SetBasicAccessoryDecoderPacketHandler(BasicAccDecoderPacket_Handler, true);
    ConfigureDecoder();
+   DCC.SetAccessoryOutputs(gOutputs, (byte)(sizeof(gOutputs)/sizeof(gOutputs[0])), AccessoryOutput_Handler);
    DCC.SetupDecoder( 0x00, 0x00, kDCC_INTERRUPT );
 }
 
@@ -165,71 +169,10 @@ void setup()
 //
 void loop()
 {
-    static int addr = 0;
-    
         ////////////////////////////////////////////////////////////////
-        // Loop DCC library
+        // Loop DCC library. Output timing is handled inside.
     DCC.loop();
-    
-        ////////////////////////////////////////////////////////////////
-        // Bump to next address to test
-    if( ++addr >= (int)(sizeof(gAddresses)/sizeof(gAddresses[0])) )
-    {
-        addr = 0;
-    }
-    
-        ////////////////////////////////////////////////////////////////
-        // Turn off output?
-    if( gAddresses[addr].offMilli && gAddresses[addr].offMilli<millis() )
-    {
-            // Clear off time
-        gAddresses[addr].offMilli = 0;
-        
-            // Disable output
-        if( gAddresses[addr].isDigital )
-        {
-            digitalWrite( gAddresses[addr].outputPin, LOW);
-        }else{
-            analogWrite( gAddresses[addr].outputPin, 0);
-        }
-        
-            // If still enabled and a flash type, set on time
-        if( gAddresses[addr].output && gAddresses[addr].isFlasher)
-        {
-            gAddresses[addr].onMilli = millis() + gAddresses[addr].durationMilli;
-        }else{
-            gAddresses[addr].output = 0;
-        }
-        
-        return;
-    }
-        
-        ////////////////////////////////////////////////////////////////
-        // Turn on output?
-    if( gAddresses[addr].onMilli && gAddresses[addr].onMilli<=millis() )
-    {
-            // Clear off time
-        gAddresses[addr].onMilli = 0;
-        
-            // Enable output
-        if( gAddresses[addr].isDigital )
-        {
-            digitalWrite( gAddresses[addr].outputPin, HIGH);
-        }else{
-            analogWrite( gAddresses[addr].outputPin, gAddresses[addr].analogValue);
-        }
-        
-            // If still enabled and a flash type, set off time
-        if( gAddresses[addr].durationMilli )
-        {
-            gAddresses[addr].offMilli = millis() + gAddresses[addr].durationMilli;
-        }
-        
-        return;
-    }
-    
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
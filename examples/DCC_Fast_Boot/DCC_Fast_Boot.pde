@@ -0,0 +1,131 @@
+#include <DCC_Decoder.h>
+#include <DCC_Encoder.h>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Fast power on test. Boots the decoder from a CV snapshot and sends it one packet straight away with DCC_Encoder through
+// InjectHalfPeriod (no track needed). Passes if that very first packet is acted on. Reports real micros() from the start of
+// setup until the packet is handled, and the library's boot to first packet time on the edge clock.
+//
+// The snapshot lives in a RAM array here so the test runs anywhere. On a real decoder Storage_Read and Storage_Write
+// would be eeprom_read_block and eeprom_write_block.
+//
+// Defines and structures
+//
+#define kTEST_ADDRESS             3
+#define kTEST_CORRUPT             0           // Set 1 to damage the snapshot. The first packet should then be ignored.
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Global data
+//
+byte            gStorage[kCV_SNAPSHOT_SIZE];
+DCC_Encoder     gEncoder;
+boolean         gFirstPacketHandled = false;
+unsigned long   gSetupMicros;
+unsigned long   gFirstPacketMicros;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Snapshot storage
+//
+void Storage_Read(int offset, byte* data, int length)
+{
+    memcpy(data, &gStorage[offset], length);
+}
+
+void Storage_Write(int offset, byte* data, int length)
+{
+    memcpy(&gStorage[offset], data, length);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Baseline packet handler. Only called for packets to this decoder's address.
+//
+void BaselineControlPacket_Handler(int address, int speed, int direction)
+{
+    if( !gFirstPacketHandled )
+    {
+        gFirstPacketMicros = micros();
+        gFirstPacketHandled = true;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Setup. Runs the test once.
+//
+void setup()
+{
+    gSetupMicros = micros();
+    Serial.begin(115200);
+
+        // Snapshot a previous power on would have saved. Then forget the address so it has to come from the snapshot.
+    DCC.WriteCV(kCV_PrimaryAddress, kTEST_ADDRESS);
+    DCC.WriteCV(kCV_ConfigurationData1, 0x02);
+    DCC.SaveCVSnapshot(Storage_Write);
+    DCC.WriteCV(kCV_PrimaryAddress, 0);
+    DCC.WriteCV(kCV_ConfigurationData1, 0);
+    gStorage[kCV_SNAPSHOT_HEADER+kCV_PrimaryAddress] ^= kTEST_CORRUPT;
+
+        // Power on
+    DCC.SetBaselineControlPacketHandler(BaselineControlPacket_Handler, false);
+    boolean valid = DCC.SetupDecoderFromSnapshot(0x00, 0x00, kDCC_NO_INTERRUPT, Storage_Read);
+
+        // First packet right after boot, with the shortest preamble allowed. Speed step 6 forward (28 steps).
+    byte packet[2] = { kTEST_ADDRESS, 0x74 };
+    unsigned long expected = 0;
+    unsigned int period;
+
+    gEncoder.SetPreambleBits(kPREAMBLE_MIN);
+    gEncoder.LoadPacket(packet, 2);
+    while( (period = gEncoder.NextHalfPeriod()) != 0 )
+    {
+        DCC.InjectHalfPeriod(period);
+        expected += period;
+        for(byte i=0; i<4; ++i)
+        {
+            DCC.loop();
+        }
+    }
+
+        // Report
+    Serial.print("Snapshot valid: ");
+    Serial.println(valid ? "yes" : "no");
+    Serial.print("Address from snapshot: ");
+    Serial.println(DCC.Address());
+    Serial.print("First packet handled: ");
+    Serial.println(gFirstPacketHandled ? "yes" : "no");
+    if( gFirstPacketHandled )
+    {
+        Serial.print("Setup to first packet handled: ");
+        Serial.print(gFirstPacketMicros - gSetupMicros);
+        Serial.println("us real time");
+        Serial.print("Boot to first packet end bit: ");
+        Serial.print(DCC.MicrosecondsFromBootToFirstPacket());
+        Serial.print("us edge clock (packet itself is ");
+        Serial.print(expected);
+        Serial.println("us)");
+    }
+
+    boolean pass = (valid == !kTEST_CORRUPT) && (gFirstPacketHandled == !kTEST_CORRUPT);
+    Serial.println(pass ? "PASS" : "FAIL");
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Main loop
+//
+void loop()
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
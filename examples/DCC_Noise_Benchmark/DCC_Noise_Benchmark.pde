@@ -0,0 +1,291 @@
+#include <DCC_Decoder.h>
+#include <DCC_Encoder.h>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Robustness benchmark. Drives the decoder with DCC_Encoder traffic through InjectHalfPeriod (no track needed), perturbed
+// by timing jitter, dropped and extra edges, half bit misalignment and slow loop() schedules. Reports packet yield, false
+// accepts (packets that pass error detection but differ from what was sent) and counts of each kDCC_ERR_* result.
+//
+// Runs on any board. It only uses Serial, so it also runs on a desktop host: extras/host has an Arduino.h stand-in and a
+// Makefile that builds it with and without DCC_TIMESTAMP_TIMER1.
+//
+// Defines and structures
+//
+#define kPACKETS_PER_SCENARIO     2000
+#define kERROR_CODES              7           // kDCC_ERR_DETECTION_FAILED .. kDCC_ERR_MISSING_END_BIT
+
+typedef struct
+{
+    const char*       name;
+    byte              preambleBits;           // Preamble length sent
+    byte              jitterMicros;           // +/- random offset on every half period
+    unsigned int      dropPer10000;           // Edges dropped per 10000. Two half periods merge into one
+    unsigned int      extraPer10000;          // Glitch edges per 10000. A half period splits in two
+    byte              misalignPer100;         // Packets per 100 preceded by a stray half period
+    byte              loopsPer10Halves;       // DCC.loop() calls per 10 half periods. 10 = once per half period
+} NoiseScenario;
+
+NoiseScenario gScenarios[] =
+{
+    //  name                preamble jitter drop extra misalign loops
+    { "Clean",              14,      0,     0,   0,    0,       40 },
+    { "Short preamble",     10,      0,     0,   0,    0,       40 },
+    { "Jitter 4us",         14,      4,     0,   0,    0,       40 },
+    { "Jitter 8us",         14,      8,     0,   0,    0,       40 },
+    { "Dropped edges",      14,      2,     10,  0,    0,       40 },
+    { "Glitch edges",       14,      2,     0,   10,   0,       40 },
+    { "Misaligned",         12,      2,     0,   0,    25,      40 },
+    { "Slow loop",          14,      2,     0,   0,    0,       10 },
+    { "Very slow loop",     14,      2,     0,   0,    0,       6  },
+    { "Everything",         14,      6,     5,   5,    10,      12 },
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Global data
+//
+DCC_Encoder     gEncoder;
+uint16_t        gRandom = 1;                  // xorshift16 state. 16 bits so AVR and host runs match
+
+    // Last two packets sent. The decoder can finish a packet after the next one has started.
+byte            gSent[2][kPACKET_LEN_MAX];
+byte            gSentLength[2];
+boolean         gSentMatched[2];
+byte            gSentIndex = 0;
+
+    // Results for the running scenario
+unsigned long   gPacketsSent;
+unsigned long   gPacketsGood;
+unsigned long   gFalseAccepts;
+unsigned long   gErrors[kERROR_CODES];
+unsigned long   gHalfPeriods;
+
+int             gScenario = 0;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Helpers
+//
+uint16_t NextRandom()
+{
+    gRandom ^= gRandom << 7;
+    gRandom ^= gRandom >> 9;
+    gRandom ^= gRandom << 8;
+    return gRandom;
+}
+
+boolean Chance(unsigned int per10000)
+{
+    return per10000 && (NextRandom() % 10000) < per10000;
+}
+
+void LoadRandomPacket()
+{
+    byte data[kPACKET_LEN_MAX-1];
+    byte count = kPACKET_LEN_MIN-1 + (NextRandom() % (kPACKET_LEN_MAX-kPACKET_LEN_MIN+1));
+
+    for(byte i=0; i<count; ++i)
+    {
+        data[i] = NextRandom();
+    }
+    gEncoder.LoadPacket(data, count);
+
+    gSentIndex ^= 1;
+    memcpy(gSent[gSentIndex], data, count);
+    gSent[gSentIndex][count] = DCC_Encoder::ErrorByte(data, count);
+    gSentLength[gSentIndex] = count+1;
+    gSentMatched[gSentIndex] = false;
+    ++gPacketsSent;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Decoder handlers
+//
+boolean RawPacket_Handler(byte byteCount, byte* packetBytes)
+{
+    for(byte i=0; i<2; ++i)
+    {
+        if( !gSentMatched[i] && gSentLength[i]==byteCount && !memcmp(gSent[i], packetBytes, byteCount) )
+        {
+            gSentMatched[i] = true;
+            ++gPacketsGood;
+            return true;
+        }
+    }
+    ++gFalseAccepts;
+    return true;
+}
+
+void DecodingEngineCompletion_Handler(byte resultOfLastPacket)
+{
+    if( resultOfLastPacket>=kDCC_ERR_DETECTION_FAILED && resultOfLastPacket<kDCC_ERR_DETECTION_FAILED+kERROR_CODES )
+    {
+        ++gErrors[resultOfLastPacket-kDCC_ERR_DETECTION_FAILED];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Run one scenario
+//
+void RunScenario(NoiseScenario* scenario)
+{
+    gPacketsSent = gPacketsGood = gFalseAccepts = gHalfPeriods = 0;
+    memset(gErrors, 0, sizeof(gErrors));
+
+    gEncoder.SetPreambleBits(scenario->preambleBits);
+    gEncoder.SetJitter(scenario->jitterMicros, 12345);
+    gRandom = 1;
+
+    unsigned int carry = 0;
+    byte loopCredit = 0;
+
+    while( gPacketsSent < kPACKETS_PER_SCENARIO )
+    {
+        LoadRandomPacket();
+
+            // Half bit misalignment. A stray half period ahead of the preamble.
+        if( (NextRandom() % 100) < scenario->misalignPer100 )
+        {
+            DCC.InjectHalfPeriod(kENCODER_ONE_HALF);
+        }
+
+        unsigned int period;
+        while( (period = gEncoder.NextHalfPeriod()) != 0 )
+        {
+                // Dropped edge. This half period merges with the next.
+            if( Chance(scenario->dropPer10000) )
+            {
+                carry += period;
+                continue;
+            }
+            period += carry;
+            carry = 0;
+
+                // Extra edge. Split the half period at a random point.
+            if( period>1 && Chance(scenario->extraPer10000) )
+            {
+                unsigned int split = 1 + NextRandom() % (period-1);
+                DCC.InjectHalfPeriod(split);
+                DCC.InjectHalfPeriod(period-split);
+                gHalfPeriods += 2;
+            }else{
+                DCC.InjectHalfPeriod(period);
+                ++gHalfPeriods;
+            }
+
+                // loop() schedule
+            loopCredit += scenario->loopsPer10Halves;
+            while( loopCredit >= 10 )
+            {
+                loopCredit -= 10;
+                DCC.loop();
+            }
+        }
+    }
+
+        // Report
+    Serial.print(scenario->name);
+    Serial.print(": sent ");
+    Serial.print(gPacketsSent);
+    Serial.print("  yield ");
+    Serial.print((gPacketsGood*1000)/gPacketsSent/10);
+    Serial.print(".");
+    Serial.print((gPacketsGood*1000)/gPacketsSent%10);
+    Serial.print("%  false accepts ");
+    Serial.print(gFalseAccepts);
+    Serial.print("  half periods ");
+    Serial.println(gHalfPeriods);
+
+    for(byte i=0; i<kERROR_CODES; ++i)
+    {
+        if( gErrors[i] )
+        {
+            Serial.print("    ");
+            Serial.print(DCC.ResultString(kDCC_ERR_DETECTION_FAILED+i));
+            Serial.print(": ");
+            Serial.println(gErrors[i]);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Edge timestamp cost and resolution of the compiled backend (micros() or DCC_TIMESTAMP_TIMER1). Build once each way to 
+// compare. Cost is the whole edge interrupt handler, timestamp read included. Resolution is the smallest step seen on 
+// the edge clock. Runs before any edges are injected, while EdgeMicros() still follows the real clock.
+//
+void TimestampCost()
+{
+    unsigned long cost = DCC.InterruptCostMicros(1000);
+    
+    unsigned long resolution = 0xFFFFFFFF;
+    for(byte sample=0; sample<16; ++sample)
+    {
+        unsigned long first = DCC.EdgeMicros();
+        unsigned long next = first;
+        for(unsigned int i=0; i<10000 && next==first; ++i)
+        {
+            next = DCC.EdgeMicros();
+        }
+        if( next != first && next-first < resolution )
+        {
+            resolution = next-first;
+        }
+    }
+    
+#if defined(DCC_TIMESTAMP_TIMER1)
+    Serial.print("Timer1 edge clock. ");
+#else
+    Serial.print("micros() edge clock. ");
+#endif
+    Serial.print("Interrupt x1000: ");
+    Serial.print(cost);
+    Serial.print("us   Resolution: ");
+    if( resolution == 0xFFFFFFFF )
+    {
+        Serial.println("clock not running");
+    }else{
+        Serial.print(resolution);
+        Serial.println("us");
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Setup
+//
+void setup()
+{
+    Serial.begin(115200);
+    DCC.SetRawPacketHandler(RawPacket_Handler);
+    DCC.SetDecodingEngineCompletionStatusHandler(DecodingEngineCompletion_Handler);
+    DCC.SetupMonitor( kDCC_NO_INTERRUPT );
+
+    TimestampCost();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Main loop. One scenario per pass.
+//
+void loop()
+{
+    if( gScenario < (int)(sizeof(gScenarios)/sizeof(gScenarios[0])) )
+    {
+        RunScenario(&gScenarios[gScenario++]);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,138 @@
+//
+// Arduino.cpp - Desktop stand-in for the Arduino core. Clock, Serial and main().
+// Released into the public domain.
+//
+
+#include <time.h>
+#include "Arduino.h"
+
+    // Arduino's main() calls loop() forever. A host run has to end, so it stops after this many.
+#ifndef kHOST_LOOPS
+#define kHOST_LOOPS                   1000
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Clock. Monotonic time since the first call, so micros() starts near 0 and wraps like the real one.
+//
+static unsigned long long HostMicros()
+{
+    static unsigned long long start = 0;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long long us = (unsigned long long)now.tv_sec*1000000 + now.tv_nsec/1000;
+    if( !start )
+    {
+        start = us - 1;     // Never 0. The library reads micros()==0 as not started yet.
+    }
+    return us - start;
+}
+
+unsigned long micros()
+{
+    return (uint32_t)HostMicros();
+}
+
+unsigned long millis()
+{
+    return (uint32_t)(HostMicros()/1000);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// No interrupts or pins on a host
+//
+void noInterrupts()
+{
+}
+
+void interrupts()
+{
+}
+
+void attachInterrupt(uint8_t interrupt, void (*func)(), int mode)
+{
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+}
+
+void analogWrite(uint8_t pin, int value)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Serial
+//
+Print Serial;
+
+size_t Print::write(uint8_t c)
+{
+    return putchar(c)==EOF ? 0 : 1;
+}
+
+size_t Print::print(const char* s)
+{
+    size_t n = 0;
+    while( *s )
+    {
+        n += write(*s++);
+    }
+    return n;
+}
+
+size_t Print::print(char c)
+{
+    return write(c);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char buffer[12];
+    snprintf(buffer, sizeof(buffer), (base==HEX) ? "%lX" : "%lu", n);
+    return print(buffer);
+}
+
+size_t Print::print(long n, int base)
+{
+    if( base==HEX )
+    {
+        return print((unsigned long)n, base);
+    }
+    char buffer[12];
+    snprintf(buffer, sizeof(buffer), "%ld", n);
+    return print(buffer);
+}
+
+size_t Print::println()
+{
+    return write('\n');
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// main
+//
+int main()
+{
+    setup();
+    for(unsigned long i=0; i<kHOST_LOOPS; ++i)
+    {
+        loop();
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,76 @@
+//
+// Arduino.h - Desktop stand-in for the parts of the Arduino core this library and its examples use.
+// Lets sketches that need no track (DCC_Noise_Benchmark, DCC_Fast_Boot) build and run on a host. See Makefile.
+// Released into the public domain.
+//
+
+#ifndef __ARDUINO_HOST_H__
+#define __ARDUINO_HOST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+#define PROGMEM
+#define _BV(bit)                      (1 << (bit))
+
+#define LOW                           0
+#define HIGH                          1
+#define INPUT                         0
+#define OUTPUT                        1
+#define CHANGE                        1
+
+#define DEC                           10
+#define HEX                           16
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+    // Real time since the program started. No interrupts on a host, so noInterrupts() and
+    // attachInterrupt() do nothing and pins go nowhere.
+unsigned long millis();
+unsigned long micros();
+
+void noInterrupts();
+void interrupts();
+void attachInterrupt(uint8_t interrupt, void (*func)(), int mode);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+void analogWrite(uint8_t pin, int value);
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+    // Serial writes to stdout. Numbers print in Arduino's format (HEX is upper case, no prefix).
+class Print
+{
+public:
+    void begin(long baud) {}
+
+    virtual size_t write(uint8_t c);
+
+    size_t print(const char* s);
+    size_t print(char c);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC)  { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC)           { return print((long)n, base); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+
+    size_t println();
+    template<class T> size_t println(T value)           { size_t n = print(value); return n + println(); }
+    template<class T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+};
+
+extern Print Serial;
+
+    // Provided by the sketch
+void setup();
+void loop();
+
+#endif